@@ -0,0 +1,215 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+// queue throughput, synthetic jobs submitted in drops and run by a no-op executor
+//
+// usage: queuebench [shapes] [sizes] [threads] [journal]
+//        queuebench flat,chain,fanout 10000,100000,1000000 8
+//
+// flat jobs are independent, chain jobs depend on the job before them in chains
+// of 100 and fanout jobs depend on a root with 1000 dependents. every shape and
+// size runs in its own child so peak memory is its own. the journal is off, its
+// fsyncs run on the queue thread with the executor and would count as dispatch
+// latency, pass journal as a fourth argument to measure with it. one json
+// object is printed per run
+
+#include "queue.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSemaphore>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QVector>
+
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+enum {
+    Drop = 1000, // jobs per submit
+    Chain = 100, // jobs per chain
+    Fanout = 1000 // dependents per root
+};
+
+class Noop : public Queue::Executor
+{
+    public:
+        int run(QSharedPointer<Job> job) override {
+            // latency from ready, the later of the submit and the parent finishing
+            qint64 now = timer.nsecsElapsed();
+            int index = indexes.value(job->uuid());
+            int parent = parents[index];
+            qint64 ready = (parent < 0) ? submitted[index] : qMax(submitted[index], finished[parent]);
+            latencies.append(now - ready);
+            finished[index] = timer.nsecsElapsed();
+            return 0;
+        }
+        QElapsedTimer timer;
+        QHash<QUuid, int> indexes;
+        QVector<int> parents;
+        QVector<qint64> submitted; // ns, written before the submit holding the job
+        QVector<qint64> finished; // ns, queue thread only
+        QVector<qint64> latencies;
+};
+
+int
+parentOf(const QString& shape, int index)
+{
+    if (shape == "chain" && index % Chain) {
+        return index - 1;
+    }
+    if (shape == "fanout" && index % (Fanout + 1)) {
+        return index - index % (Fanout + 1);
+    }
+    return -1;
+}
+
+qint64
+peakMemory()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(Q_OS_MACOS)
+    return usage.ru_maxrss; // bytes
+#else
+    return static_cast<qint64>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+}
+
+int
+bench(const QString& shape, int count, int threads, bool journaling)
+{
+    QTemporaryDir output;
+    qint64 baseline = peakMemory(); // the application and queue before any job
+    Noop noop;
+    noop.parents.resize(count);
+    noop.submitted.resize(count);
+    noop.finished.resize(count);
+    noop.latencies.reserve(count);
+    QList<QSharedPointer<Job>> jobs;
+    jobs.reserve(count);
+    QUuid batch; // one per drop
+    for (int i = 0; i < count; ++i) {
+        if (i % Drop == 0) {
+            batch = QUuid::createUuid();
+        }
+        JobSpec spec;
+        spec.uuid = QUuid::createUuid();
+        spec.batch = batch;
+        spec.id = "@1";
+        spec.name = QString("Job %1").arg(i);
+        spec.preset = shape;
+        spec.command = "noop";
+        spec.arguments = QStringList() << QString::number(i); // unique, nothing is coalesced
+        spec.output = output.path();
+        int parent = parentOf(shape, i);
+        if (parent >= 0) {
+            spec.dependson = jobs[parent]->uuid();
+        }
+        QSharedPointer<Job> job(new Job(spec));
+        noop.parents[i] = parent;
+        noop.indexes.insert(job->uuid(), i);
+        jobs.append(job);
+    }
+    Queue* queue = Queue::instance();
+    QSemaphore processed;
+    QObject::connect(queue, &Queue::jobProcessed, [&processed](const QUuid&) {
+        processed.release();
+    });
+    queue->setThreads(threads);
+    queue->setExecutor(&noop);
+    queue->setJournaling(journaling);
+    noop.timer.start();
+    qint64 submitting = 0;
+    for (int i = 0; i < count; i += Drop) {
+        QList<QSharedPointer<Job>> drop = jobs.mid(i, Drop);
+        qint64 start = noop.timer.nsecsElapsed();
+        std::fill(noop.submitted.begin() + i, noop.submitted.begin() + qMin(count, i + Drop), start);
+        queue->submit(drop);
+        submitting += noop.timer.nsecsElapsed() - start;
+    }
+    processed.acquire(count);
+    qint64 elapsed = noop.timer.nsecsElapsed();
+
+    QVector<qint64> latencies = noop.latencies;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return latencies[qMin(latencies.size() - 1, static_cast<qsizetype>(p * latencies.size()))] / 1000.0;
+    };
+    QJsonObject latency {
+        { "p50", percentile(0.50) },
+        { "p90", percentile(0.90) },
+        { "p99", percentile(0.99) },
+        { "p999", percentile(0.999) },
+        { "max", latencies.last() / 1000.0 }
+    };
+    QJsonObject result {
+        { "benchmark", "queue" },
+        { "shape", shape },
+        { "jobs", count },
+        { "threads", threads },
+        { "journal", journaling },
+        { "submit_seconds", submitting / 1e9 },
+        { "submit_rate", count / (submitting / 1e9) }, // jobs per second
+        { "total_seconds", elapsed / 1e9 },
+        { "throughput", count / (elapsed / 1e9) }, // jobs per second, submit to last completion
+        { "dispatch_latency_us", latency },
+        { "peak_memory_mb", peakMemory() / (1024.0 * 1024.0) },
+        { "memory_per_job_bytes", static_cast<double>(peakMemory() - baseline) / count } // job, graph node, queue and journal entries
+    };
+    printf("%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+    fflush(stdout);
+    return 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+    QStringList shapes = QString((argc > 1) ? argv[1] : "flat,chain,fanout").split(',');
+    QStringList sizes = QString((argc > 2) ? argv[2] : "10000,100000,1000000").split(',');
+    int threads = (argc > 3) ? atoi(argv[3]) : QThread::idealThreadCount();
+    bool journaling = (argc > 4) && QString(argv[4]) == "journal";
+    for (const QString& shape : shapes) {
+        if (shape != "flat" && shape != "chain" && shape != "fanout") {
+            fprintf(stderr, "usage: %s [flat,chain,fanout] [sizes] [threads] [journal]\n", argv[0]);
+            return 1;
+        }
+    }
+    int failed = 0;
+    for (const QString& shape : shapes) {
+        for (const QString& size : sizes) {
+            int count = size.toInt();
+            if (count <= 0) {
+                continue;
+            }
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                // journal, cache and captures go to a directory of their own
+                QTemporaryDir data;
+                qputenv("XDG_DATA_HOME", QFile::encodeName(data.path()));
+                QCoreApplication app(argc, argv);
+                app.setApplicationName("queuebench");
+                int result = bench(shape, count, threads, journaling);
+                data.remove();
+                _exit(result); // the queue singleton is not torn down, exit stops its thread
+            }
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "%s %d failed\n", shape.toUtf8().constData(), count);
+                failed++;
+            }
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,126 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+// spawn latency, direct posix_spawn from a large parent versus the spawn helper
+//
+// usage: spawnbench <helper> [iterations] [ballast in mb]
+
+#include "spawner.h"
+#include "supervisor.h"
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QVector>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+extern char** environ;
+
+class Waiter : public Supervisor::Client
+{
+    public:
+        void readyRead(Supervisor::Channel, const char*, qint64) override {}
+        void finished(int) override {
+            QMutexLocker locker(&mutex);
+            done = true;
+            condition.wakeAll();
+        }
+        void wait() {
+            QMutexLocker locker(&mutex);
+            while (!done) {
+                condition.wait(&mutex);
+            }
+            done = false;
+        }
+        bool done = false;
+        QMutex mutex;
+        QWaitCondition condition;
+};
+
+void
+report(const char* name, QVector<qint64> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    qint64 total = 0;
+    for (qint64 sample : samples) {
+        total += sample;
+    }
+    auto percentile = [&](double p) {
+        return samples[qMin(samples.size() - 1, static_cast<int>(p * samples.size()))] / 1000.0;
+    };
+    printf("%-8s mean %8.1f us  p50 %8.1f us  p95 %8.1f us  p99 %8.1f us\n",
+           name, total / 1000.0 / samples.size(), percentile(0.50), percentile(0.95), percentile(0.99));
+}
+
+int
+main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <helper> [iterations] [ballast in mb]\n", argv[0]);
+        return 1;
+    }
+    int iterations = (argc > 2) ? atoi(argv[2]) : 1000;
+    size_t ballast = (argc > 3) ? static_cast<size_t>(atoi(argv[3])) << 20 : 0;
+    if (!Spawner::instance()->start(argv[1])) {
+        return 1;
+    }
+    // touched ballast makes fork pay for page tables like a long running ui would
+    QByteArray memory(static_cast<qsizetype>(ballast), 0);
+    for (qsizetype i = 0; i < memory.size(); i += 4096) {
+        memory[i] = 1;
+    }
+    QByteArray program = "/usr/bin/true";
+    char* args[] = { program.data(), nullptr };
+    QVector<qint64> direct, helper;
+    Waiter waiter;
+    QElapsedTimer timer;
+    for (int i = 0; i < iterations; ++i) {
+        int fds[2];
+        pipe(fds);
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+        pid_t pid;
+        timer.start();
+        posix_spawn(&pid, program.constData(), &actions, nullptr, args, environ);
+        direct.append(timer.nsecsElapsed());
+        posix_spawn_file_actions_destroy(&actions);
+        close(fds[1]);
+        close(fds[0]);
+        waitpid(pid, nullptr, 0);
+
+        pipe(fds);
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+        int error = 0;
+        timer.start();
+        pid = Spawner::instance()->spawn(program, QList<QByteArray>(), QByteArray(), fds[1], fds[1], &error);
+        helper.append(timer.nsecsElapsed());
+        close(fds[1]);
+        if (pid <= 0) {
+            fprintf(stderr, "helper spawn failed: %s\n", strerror(error));
+            return 1;
+        }
+        Supervisor::instance()->watch(pid, fds[0], -1, &waiter, true);
+        waiter.wait();
+    }
+    printf("iterations %d, ballast %zu mb\n", iterations, ballast >> 20);
+    report("direct", direct);
+    report("helper", helper);
+    Spawner::instance()->stop();
+    return 0;
+}
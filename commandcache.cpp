@@ -0,0 +1,201 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "commandcache.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QMutex>
+#include <QPointer>
+#include <QSet>
+#include <QSettings>
+#include <QDebug>
+
+QScopedPointer<CommandCache, CommandCache::Deleter> CommandCache::pi;
+
+class CommandCachePrivate : public QObject
+{
+    Q_OBJECT
+    public:
+        CommandCachePrivate();
+        void init();
+        void watch();
+        QString find(const QString& command) const;
+    
+    public Q_SLOTS:
+        void directoryChanged(const QString& path);
+
+    public:
+        QStringList searchpaths;
+        QStringList paths;
+        QStringList directories; // of absolute commands resolved
+        QSet<QString> standins; // watched in place of a directory that doesn't exist yet
+        QHash<QString, QString> commands;
+        QScopedPointer<QFileSystemWatcher> watcher;
+        mutable QMutex mutex;
+        QPointer<CommandCache> cache;
+};
+
+CommandCachePrivate::CommandCachePrivate()
+{
+}
+
+void
+CommandCachePrivate::init()
+{
+    QSettings settings(MACOSX_BUNDLE_GUI_IDENTIFIER, "Jobman");
+    searchpaths = settings.value("searchpaths", QStringList()).toStringList();
+    paths = QString::fromLocal8Bit(qgetenv("PATH")).split(':', Qt::SkipEmptyParts);
+    watcher.reset(new QFileSystemWatcher());
+    connect(watcher.data(), &QFileSystemWatcher::directoryChanged, this, &CommandCachePrivate::directoryChanged);
+    watch();
+}
+
+void
+CommandCachePrivate::watch()
+{
+    QStringList current = watcher->directories();
+    if (!current.isEmpty()) {
+        watcher->removePaths(current); // removed search paths and old stand-ins go as well
+    }
+    QStringList watched;
+    {
+        QMutexLocker locker(&mutex);
+        watched = searchpaths + paths + directories;
+    }
+    // a missing directory is watched through its nearest existing parent,
+    // creating it changes the parent and the watch is set up again
+    QStringList existing;
+    standins.clear();
+    for (const QString& path : watched) {
+        QString directory = QFileInfo(path).absoluteFilePath();
+        while (!QFileInfo(directory).isDir()) {
+            QString parent = QFileInfo(directory).absolutePath();
+            if (parent == directory) {
+                break;
+            }
+            directory = parent;
+        }
+        if (directory != QFileInfo(path).absoluteFilePath()) {
+            standins.insert(directory);
+        }
+        if (QFileInfo(directory).isDir() && !existing.contains(directory)) {
+            existing.append(directory);
+        }
+    }
+    if (!existing.isEmpty()) {
+        watcher->addPaths(existing);
+    }
+}
+
+QString
+CommandCachePrivate::find(const QString& command) const
+{
+    QFileInfo commandInfo(command);
+    if (commandInfo.isAbsolute()) {
+        return commandInfo.exists() ? command : QString();
+    }
+    for (const QString& searchpath : searchpaths) {
+        QString filepath = QDir::cleanPath(QDir(searchpath).filePath(command));
+        if (QFile::exists(filepath)) {
+            return filepath;
+        }
+    }
+    for (const QString& path : paths) {
+        QFileInfo fileInfo(QDir(path).filePath(command));
+        if (fileInfo.isFile() && fileInfo.isExecutable()) {
+            return fileInfo.filePath();
+        }
+    }
+    return QString();
+}
+
+void
+CommandCachePrivate::directoryChanged(const QString& path)
+{
+    {
+        QMutexLocker locker(&mutex);
+        commands.clear(); // a tool was added or removed, resolve again
+    }
+    if (standins.contains(path) || !QFileInfo(path).isDir()) {
+        watch(); // a missing directory may exist now, or a watched one went away
+    }
+}
+
+#include "commandcache.moc"
+
+CommandCache::CommandCache()
+: p(new CommandCachePrivate())
+{
+    p->cache = this;
+    p->init();
+}
+
+CommandCache::~CommandCache()
+{
+}
+
+CommandCache*
+CommandCache::instance()
+{
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    if (!pi) {
+        pi.reset(new CommandCache());
+    }
+    return pi.data();
+}
+
+QString
+CommandCache::resolve(const QString& command)
+{
+    QMutexLocker locker(&p->mutex);
+    auto it = p->commands.constFind(command);
+    if (it != p->commands.constEnd()) {
+        return it.value();
+    }
+    QString resolved = p->find(command); // misses are cached as well
+    p->commands.insert(command, resolved);
+    QFileInfo commandInfo(command);
+    if (commandInfo.isAbsolute() && !p->directories.contains(commandInfo.absolutePath())) {
+        // installing or removing the tool changes its directory
+        p->directories.append(commandInfo.absolutePath());
+        QMetaObject::invokeMethod(p.data(), [this]() {
+            p->watch();
+        }, Qt::QueuedConnection);
+    }
+    return resolved;
+}
+
+QStringList
+CommandCache::searchpaths() const
+{
+    QMutexLocker locker(&p->mutex);
+    return p->searchpaths;
+}
+
+void
+CommandCache::setSearchpaths(const QStringList& searchpaths)
+{
+    {
+        QMutexLocker locker(&p->mutex);
+        if (p->searchpaths == searchpaths) {
+            return;
+        }
+        p->searchpaths = searchpaths;
+        p->commands.clear();
+    }
+    QMetaObject::invokeMethod(p.data(), [this]() {
+        p->watch();
+    }, Qt::QueuedConnection);
+}
+
+void
+CommandCache::invalidate()
+{
+    QMutexLocker locker(&p->mutex);
+    p->commands.clear();
+}
@@ -0,0 +1,35 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include <QObject>
+#include <QScopedPointer>
+#include <QStringList>
+
+class CommandCachePrivate;
+class CommandCache : public QObject
+{
+    Q_OBJECT
+    public:
+        static CommandCache* instance();
+        QString resolve(const QString& command);
+        QStringList searchpaths() const;
+        void setSearchpaths(const QStringList& searchpaths);
+        void invalidate();
+
+    private:
+        CommandCache();
+        ~CommandCache();
+        CommandCache(const CommandCache&) = delete;
+        CommandCache& operator=(const CommandCache&) = delete;
+        class Deleter {
+        public:
+            static void cleanup(CommandCache* pointer) {
+                delete pointer;
+            }
+        };
+        static QScopedPointer<CommandCache, Deleter> pi;
+        QScopedPointer<CommandCachePrivate> p;
+};
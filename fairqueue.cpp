@@ -0,0 +1,220 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "fairqueue.h"
+
+// weighted fair queuing across batches, each batch keeps its own priority heap
+// and a virtual time advanced by the slots it is charged divided by its weight,
+// the weight its jobs carry. active batches are ordered by the key of their
+// head, aging included, in levels one step wide and then by virtual time.
+// batches with heads at the same level go to the least served one and a small
+// drop is served alongside a large backfill, ahead of it if it weighs more. a
+// job that aged past fresher work lifts its whole batch, and the head is the
+// highest key in its batch so the jobs behind it are never ranked lower. virtual time is where the last served batch
+// started, a batch that becomes active starts there and can't bank credit
+// while it was idle. drained batches are erased, a batch still ahead of
+// virtual time is remembered until it's caught up so it can't skip its debt
+
+bool
+FairQueue::Order::operator<(const Order& other) const
+{
+    if (level != other.level) {
+        return level > other.level;
+    }
+    if (vtime != other.vtime) {
+        return vtime < other.vtime;
+    }
+    return sequence < other.sequence;
+}
+
+FairQueue::FairQueue(qint64 step)
+: step(qMax<qint64>(1, step))
+, sequence(0)
+, vtime(0)
+, count(0)
+{
+}
+
+void
+FairQueue::push(QSharedPointer<Job> job, qint64 key, quint64 jobsequence)
+{
+    QUuid uuid = job->uuid();
+    if (jobbatches.contains(uuid)) {
+        update(uuid, key);
+        return;
+    }
+    QUuid batchuuid = job->batch();
+    BatchIterator it = batches.find(batchuuid);
+    if (it == batches.end()) {
+        it = batches.insert(batchuuid, Batch());
+        it->sequence = sequence++;
+        it->vtime = qMax(vtime, idle.take(batchuuid));
+    }
+    it->jobs.push(job, key, jobsequence);
+    jobbatches.insert(uuid, batchuuid);
+    count++;
+    settle(it);
+}
+
+QSharedPointer<Job>
+FairQueue::pop()
+{
+    if (active.isEmpty()) {
+        return QSharedPointer<Job>();
+    }
+    BatchIterator it = batches.find(active.first());
+    QSharedPointer<Job> job = it->jobs.pop();
+    jobbatches.remove(job->uuid());
+    count--;
+    settle(it);
+    return job;
+}
+
+QSharedPointer<Job>
+FairQueue::top() const
+{
+    if (active.isEmpty()) {
+        return QSharedPointer<Job>();
+    }
+    return batches.constFind(active.first())->jobs.top();
+}
+
+void
+FairQueue::charge(QSharedPointer<Job> job)
+{
+    QUuid batchuuid = job->batch();
+    double slots = qMax(1, job->cpus()) / (job->weight() > 0 ? job->weight() : 1.0); // a lighter batch pays more per job
+    BatchIterator it = batches.find(batchuuid);
+    if (it != batches.end()) {
+        vtime = qMax(vtime, it->vtime);
+        it->vtime += slots;
+        settle(it);
+    } else if (idle.contains(batchuuid)) { // its last job was just taken
+        double& time = idle[batchuuid];
+        vtime = qMax(vtime, time);
+        time += slots;
+        idletimes.insert(time, batchuuid);
+    }
+    // forget drained batches virtual time has caught up with
+    while (!idletimes.isEmpty() && idletimes.firstKey() <= vtime) {
+        QUuid drained = idletimes.first();
+        idletimes.erase(idletimes.begin());
+        auto found = idle.find(drained);
+        if (found != idle.end() && found.value() <= vtime) {
+            idle.erase(found);
+        }
+    }
+}
+
+bool
+FairQueue::update(const QUuid& uuid, qint64 key)
+{
+    auto it = jobbatches.constFind(uuid);
+    if (it == jobbatches.constEnd()) {
+        return false;
+    }
+    BatchIterator batch = batches.find(it.value());
+    bool updated = batch->jobs.update(uuid, key);
+    settle(batch);
+    return updated;
+}
+
+bool
+FairQueue::remove(const QUuid& uuid)
+{
+    auto it = jobbatches.find(uuid);
+    if (it == jobbatches.end()) {
+        return false;
+    }
+    BatchIterator batch = batches.find(it.value());
+    batch->jobs.remove(uuid);
+    jobbatches.erase(it);
+    count--;
+    settle(batch);
+    return true;
+}
+
+bool
+FairQueue::contains(const QUuid& uuid) const
+{
+    return jobbatches.contains(uuid);
+}
+
+qint64
+FairQueue::key(const QUuid& uuid) const
+{
+    auto it = jobbatches.constFind(uuid);
+    if (it == jobbatches.constEnd()) {
+        return 0;
+    }
+    auto batch = batches.constFind(it.value());
+    return (batch != batches.constEnd()) ? batch->jobs.key(uuid) : 0;
+}
+
+QHash<QUuid, qint64>
+FairQueue::keys() const
+{
+    QHash<QUuid, qint64> keys;
+    keys.reserve(count);
+    for (const Batch& batch : batches) {
+        keys.insert(batch.jobs.keys());
+    }
+    return keys;
+}
+
+int
+FairQueue::size() const
+{
+    return count;
+}
+
+bool
+FairQueue::isEmpty() const
+{
+    return count == 0;
+}
+
+void
+FairQueue::reserve(int size)
+{
+    jobbatches.reserve(size);
+}
+
+void
+FairQueue::clear()
+{
+    batches.clear();
+    active.clear();
+    idle.clear();
+    idletimes.clear();
+    jobbatches.clear();
+    vtime = 0;
+    count = 0;
+}
+
+void
+FairQueue::settle(BatchIterator it)
+{
+    // called after the head or virtual time of a batch changed
+    if (it->placed) {
+        active.remove(it->order);
+        it->placed = false;
+    }
+    if (it->jobs.isEmpty()) {
+        idle.insert(it.key(), it->vtime);
+        idletimes.insert(it->vtime, it.key());
+        batches.erase(it);
+        return;
+    }
+    it->order = Order { level(it->jobs.key(it->jobs.top()->uuid())), it->vtime, it->sequence };
+    it->placed = true;
+    active.insert(it->order, it.key());
+}
+
+qint64
+FairQueue::level(qint64 key) const
+{
+    // rounded down, aged keys are negative
+    return (key >= 0) ? key / step : -((-key + step - 1) / step);
+}
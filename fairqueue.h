@@ -0,0 +1,60 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include "job.h"
+#include "waitqueue.h"
+
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QSharedPointer>
+#include <QUuid>
+
+class FairQueue
+{
+    public:
+        FairQueue(qint64 step = 1);
+        void push(QSharedPointer<Job> job, qint64 key, quint64 sequence);
+        QSharedPointer<Job> pop();
+        QSharedPointer<Job> top() const;
+        void charge(QSharedPointer<Job> job);
+        bool update(const QUuid& uuid, qint64 key);
+        bool remove(const QUuid& uuid);
+        bool contains(const QUuid& uuid) const;
+        qint64 key(const QUuid& uuid) const;
+        QHash<QUuid, qint64> keys() const;
+        int size() const;
+        bool isEmpty() const;
+        void reserve(int size);
+        void clear();
+
+    private:
+        struct Order {
+            qint64 level; // key of the head job in steps, highest first
+            double vtime; // least served first
+            quint64 sequence; // oldest batch first
+            bool operator<(const Order& other) const;
+        };
+        struct Batch {
+            WaitQueue jobs;
+            double vtime = 0; // slots charged, divided by weight
+            quint64 sequence = 0;
+            Order order;
+            bool placed = false;
+        };
+        typedef QHash<QUuid, Batch>::iterator BatchIterator;
+        void settle(BatchIterator it);
+        qint64 level(qint64 key) const;
+        QHash<QUuid, Batch> batches; // with waiting jobs only
+        QMap<Order, QUuid> active; // the next job comes from the first
+        QHash<QUuid, double> idle; // drained batches and their virtual time
+        QMultiMap<double, QUuid> idletimes;
+        QHash<QUuid, QUuid> jobbatches;
+        qint64 step; // keys this close are the same level and share fairly
+        quint64 sequence;
+        double vtime;
+        int count;
+};
@@ -2,292 +2,304 @@
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/mikaelsundell/jobman
 
-#include "queue.h"
+#include "job.h"
 
-#include <QObject>
+#include <QAtomicInt>
 #include <QMutex>
-#include <QDateTime>
-#include <QPointer>
 
 #include <QDebug>
 
-class JobPrivate : public QObject
+class JobPrivate
 {
-    Q_OBJECT
     public:
-        JobPrivate();
-        void init();
+        JobPrivate(const JobSpec& spec);
 
     public:
-        QDateTime created;
-        QUuid uuid;
-        QUuid dependson;
-        QString id;
-        QString filename;
-        QString name;
-        QString command;
-        QStringList arguments;
-        QString output;
-        QString startin;
-        QString log;
-        int pid;
-        int priority;
-        Job::Status status;
-        QPointer<Job> job;
-    mutable QMutex mutex;
+        const JobSpec spec; // read without locking, never written after the job is built
+        // runtime
+        QAtomicInt status;
+        QAtomicInt pid;
+        QAtomicInt priority;
+        QAtomicInt attempt;
+        JobLog log;
+        QUuid duplicateof;
+        mutable QMutex mutex; // log and duplicateof
 };
 
-JobPrivate::JobPrivate()
-: pid(0)
-, priority(10)
+JobPrivate::JobPrivate(const JobSpec& spec)
+: spec(spec)
 , status(Job::Waiting)
+, pid(0)
+, priority(10)
+, attempt(0)
 {
-    created = QDateTime::currentDateTime();
 }
 
-void
-JobPrivate::init()
+Job::Job(const JobSpec& spec)
+: p(new JobPrivate(spec))
 {
 }
 
-#include "job.moc"
+Job::~Job()
+{
+}
 
-Job::Job()
-: p(new JobPrivate())
+const QStringList&
+Job::arguments() const
 {
-    p->job = this;
-    p->init();
+    return p->spec.arguments;
 }
 
-Job::~Job()
+int
+Job::attempt() const
 {
+    return p->attempt.loadAcquire();
 }
 
-QStringList
-Job::arguments() const
+const QUuid&
+Job::batch() const
 {
-    QMutexLocker locker(&p->mutex);
-    return p->arguments;
+    return p->spec.batch;
 }
 
-QString
+bool
+Job::cache() const
+{
+    return p->spec.cache;
+}
+
+const QString&
 Job::command() const
 {
-    QMutexLocker locker(&p->mutex);
-    return p->command;
+    return p->spec.command;
+}
+
+int
+Job::cpus() const
+{
+    return p->spec.cpus;
+}
+
+int
+Job::cputimeout() const
+{
+    return p->spec.cputimeout;
 }
 
-QDateTime
+const QDateTime&
 Job::created() const
 {
-    QMutexLocker locker(&p->mutex); // Lock the mutex
-    return p->created;
+    return p->spec.created;
 }
 
-QUuid
+const QUuid&
 Job::dependson() const
+{
+    return p->spec.dependson;
+}
+
+QUuid
+Job::duplicateof() const
 {
     QMutexLocker locker(&p->mutex);
-    return p->dependson;
+    return p->duplicateof;
 }
 
-QString
+const QString&
 Job::filename() const
 {
-    QMutexLocker locker(&p->mutex);
-    return p->filename;
+    return p->spec.filename;
 }
 
-QString
+const QString&
 Job::id() const
 {
-    QMutexLocker locker(&p->mutex);
-    return p->id;
+    return p->spec.id;
 }
 
-QString
+const QString&
+Job::input() const
+{
+    return p->spec.input;
+}
+
+const QString&
 Job::name() const
 {
-    QMutexLocker locker(&p->mutex);
-    return p->name;
+    return p->spec.name;
 }
 
 QString
 Job::log() const
 {
     QMutexLocker locker(&p->mutex);
-    return p->log;
+    return p->log.text();
 }
 
-QString
-Job::output() const
+QList<JobLog::Segment>
+Job::logSegments(qint64* revision) const
 {
     QMutexLocker locker(&p->mutex);
-    return p->output;
+    if (revision) {
+        *revision = p->log.revision();
+    }
+    return p->log.segments();
+}
+
+int
+Job::memory() const
+{
+    return p->spec.memory;
+}
+
+const QString&
+Job::output() const
+{
+    return p->spec.output;
+}
+
+const QString&
+Job::outputfile() const
+{
+    return p->spec.outputfile;
 }
 
 int
 Job::pid() const
 {
-    QMutexLocker locker(&p->mutex);
-    return p->pid;
+    return p->pid.loadAcquire();
 }
 
+const QString&
+Job::pool() const
+{
+    return p->spec.pool;
+}
+
+const QString&
+Job::preset() const
+{
+    return p->spec.preset;
+}
 
 int
 Job::priority() const
 {
-    QMutexLocker locker(&p->mutex);
-    return p->priority;
+    return p->priority.loadAcquire();
 }
 
-QString
-Job::startin() const
+const Retry&
+Job::retry() const
 {
-    QMutexLocker locker(&p->mutex);
-    return p->startin;
+    return p->spec.retry;
 }
 
-Job::Status
-Job::status() const
+const JobSpec&
+Job::spec() const
 {
-    QMutexLocker locker(&p->mutex);
-    return p->status;
+    return p->spec;
 }
 
-QUuid
-Job::uuid() const
+const QString&
+Job::startin() const
 {
-    QMutexLocker locker(&p->mutex);
-    return p->uuid;
+    return p->spec.startin;
 }
 
-void
-Job::setArguments(const QStringList& arguments)
+Job::Status
+Job::status() const
 {
-    QMutexLocker locker(&p->mutex);
-    if (p->arguments != arguments) {
-        p->arguments = arguments;
-        argumentsChanged(arguments);
-    }
+    return static_cast<Status>(p->status.loadAcquire());
 }
 
-void
-Job::setCommand(const QString& command)
+int
+Job::timeout() const
 {
-    QMutexLocker locker(&p->mutex);
-    if (p->command != command) {
-        p->command = command;
-        commandChanged(command);
-    }
+    return p->spec.timeout;
 }
 
-void
-Job::setDependson(QUuid dependson)
+const QUuid&
+Job::uuid() const
 {
-    QMutexLocker locker(&p->mutex);
-    if (p->dependson != dependson) {
-        p->dependson = dependson;
-        dependsonChanged(dependson);
-    }
+    return p->spec.uuid;
 }
 
-void
-Job::setFilename(const QString& filename)
+double
+Job::weight() const
 {
-    QMutexLocker locker(&p->mutex);
-    if (p->filename != filename) {
-        p->filename = filename;
-        filenameChanged(filename);
-    }
+    return p->spec.weight;
 }
 
 void
-Job::setId(const QString& id)
+Job::setAttempt(int attempt)
 {
-    QMutexLocker locker(&p->mutex); // Lock the mutex
-    if (p->id != id) {
-        p->id = id;
-        idChanged(id);
+    p->attempt.storeRelease(attempt);
+}
+
+void
+Job::setDuplicateof(QUuid duplicateof)
+{
+    {
+        QMutexLocker locker(&p->mutex);
+        if (p->duplicateof == duplicateof) {
+            return;
+        }
+        p->duplicateof = duplicateof;
     }
+    duplicateofChanged(duplicateof);
 }
 
 void
 Job::setLog(const QString& log)
 {
-    QMutexLocker locker(&p->mutex);
-    if (p->log != log) {
-        p->log = log;
-        logChanged(log);
+    {
+        QMutexLocker locker(&p->mutex);
+        p->log.reset(log);
     }
+    logChanged(log);
 }
 
 void
-Job::setName(const QString& name)
+Job::appendLog(JobLog::Kind kind, const QString& text)
 {
-    QMutexLocker locker(&p->mutex);
-    if (p->name != name) {
-        p->name = name;
-        nameChanged(name);
+    if (text.isEmpty()) {
+        return;
+    }
+    // emitted unlocked so listeners can read the log back, appends racing each
+    // other may arrive out of order and the position tells where each one goes
+    qint64 position = 0;
+    {
+        QMutexLocker locker(&p->mutex);
+        position = p->log.append(kind, text);
     }
+    logAppended(position, text);
 }
 
-void
-Job::setOutput(const QString& output)
+bool
+Job::archiveLog(qint64 revision)
 {
     QMutexLocker locker(&p->mutex);
-    if (p->output != output) {
-        p->output = output;
-        outputChanged(output);
-    }
+    return p->log.archive(revision);
 }
 
 void
 Job::setPid(int pid)
 {
-    QMutexLocker locker(&p->mutex);
-    if (p->pid != pid) {
-        p->pid = pid;
-        pidChanged(pid);
-    }
+    p->pid.storeRelease(pid);
 }
 
 void
 Job::setPriority(int priority)
 {
-    QMutexLocker locker(&p->mutex);
-    if (p->priority != priority) {
-        p->priority = priority;
+    if (p->priority.fetchAndStoreOrdered(priority) != priority) {
         priorityChanged(priority);
     }
 }
 
-void
-Job::setStartin(const QString& startin)
-{
-    QMutexLocker locker(&p->mutex);
-    if (p->startin != startin) {
-        p->startin = startin;
-        startinChanged(startin);
-    }
-}
-
 void
 Job::setStatus(Status status)
 {
-    QMutexLocker locker(&p->mutex);
-    if (p->status != status) {
-        p->status = status;
+    if (p->status.fetchAndStoreOrdered(status) != status) {
         statusChanged(status);
     }
 }
-
-void
-Job::setUuid(QUuid uuid)
-{
-    QMutexLocker locker(&p->mutex);
-    if (p->uuid != uuid) {
-        p->uuid = uuid;
-        uuidChanged(uuid);
-    }
-}
@@ -4,12 +4,67 @@
 
 #pragma once
 
+#include "joblog.h"
+
+#include <QDateTime>
 #include <QList>
 #include <QObject>
 #include <QScopedPointer>
 #include <QString>
+#include <QStringList>
 #include <QUuid>
 
+class Retry {
+    public:
+        Retry() = default;
+        bool operator==(const Retry& other) const {
+            return attempts == other.attempts && delay == other.delay && multiplier == other.multiplier &&
+                   maxdelay == other.maxdelay && jitter == other.jitter &&
+                   exitcodes == other.exitcodes && exitsignals == other.exitsignals;
+        }
+        bool operator!=(const Retry& other) const {
+            return !(*this == other);
+        }
+    
+    public:
+        int attempts = 1; // runs including the first, 1 for no retries
+        int delay = 1000; // ms before the first retry
+        double multiplier = 2.0; // backoff per attempt
+        int maxdelay = 60000;
+        double jitter = 0.2; // random fraction added to or removed from the delay
+        QList<int> exitcodes; // retry on these exit codes, any if both lists are empty
+        QList<int> exitsignals; // retry when killed by these signals
+};
+
+class JobSpec {
+    public:
+        JobSpec() = default;
+    
+    public:
+        QUuid uuid;
+        QUuid dependson;
+        QUuid batch;
+        QDateTime created = QDateTime::currentDateTime();
+        QString id;
+        QString filename;
+        QString name;
+        QString command;
+        QStringList arguments;
+        QString output;
+        QString startin;
+        QString pool;
+        QString input;
+        QString outputfile;
+        QString preset;
+        Retry retry;
+        int cpus = 1;
+        int memory = 0;
+        int timeout = 0;
+        int cputimeout = 0;
+        bool cache = false;
+        double weight = 1.0; // share of the queue its batch gets against others
+};
+
 class JobPrivate;
 class Job : public QObject {
     Q_OBJECT
@@ -21,55 +76,65 @@ class Job : public QObject {
             Completed,
             Failed,
             Dependency,
-            Stopped
+            Stopped,
+            Timeout,
+            Skipped // outputs up to date, nothing was run
         };
         Q_ENUM(Status)
 
     public:
-        Job();
+        Job(const JobSpec& spec);
         virtual ~Job();
-        QStringList arguments() const;
-        QString command() const;
-        QDateTime created() const;
-        QUuid dependson() const;
-        QString filename() const;
-        QString id() const;
-        QString name() const;
+        // the spec is built before the job and can't change after, it is read
+        // without locking. status, pid, priority and attempt are atomics, log
+        // and duplicateof share a lock. the log is appended in segments,
+        // logAppended carries only the new text and its position. once
+        // archived log() is a summary, Queue::log reads the whole log
+        const QStringList& arguments() const;
+        int attempt() const;
+        const QUuid& batch() const;
+        bool cache() const;
+        const QString& command() const;
+        int cpus() const;
+        int cputimeout() const;
+        const QDateTime& created() const;
+        const QUuid& dependson() const;
+        QUuid duplicateof() const;
+        const QString& filename() const;
+        const QString& id() const;
+        const QString& input() const;
+        const QString& name() const;
         QString log() const;
-        QString output() const;
+        QList<JobLog::Segment> logSegments(qint64* revision = nullptr) const;
+        int memory() const;
+        const QString& output() const;
+        const QString& outputfile() const;
         int pid() const;
+        const QString& pool() const;
+        const QString& preset() const;
         int priority() const;
-        QString startin() const;
+        const Retry& retry() const;
+        const JobSpec& spec() const;
+        const QString& startin() const;
         Status status() const;
-        QUuid uuid() const;
-        void setArguments(const QStringList& arguments);
-        void setCommand(const QString& command);
-        void setDependson(QUuid dependson);
-        void setFilename(const QString& filename);
-        void setId(const QString& id);
+        int timeout() const;
+        const QUuid& uuid() const;
+        double weight() const;
+        void setAttempt(int attempt);
+        void setDuplicateof(QUuid duplicateof);
         void setLog(const QString& log);
-        void setName(const QString& name);
-        void setOutput(const QString& output);
+        void appendLog(JobLog::Kind kind, const QString& text);
+        bool archiveLog(qint64 revision);
         void setPid(int pid);
         void setPriority(int priority);
-        void setStartin(const QString& startin);
         void setStatus(Status status);
-        void setUuid(QUuid uuid);
     
     Q_SIGNALS:
-        void argumentsChanged(const QStringList& arguments);
-        void commandChanged(const QString& command);
-        void dependsonChanged(QUuid uuid);
-        void filenameChanged(const QString& filename);
-        void idChanged(const QString& id);
+        void duplicateofChanged(QUuid duplicateof);
+        void logAppended(qint64 position, const QString& text);
         void logChanged(const QString& log);
-        void nameChanged(const QString& name);
-        void outputChanged(const QString& output);
-        void pidChanged(int pid);
         void priorityChanged(int priority);
-        void startinChanged(const QString& startin);
         void statusChanged(Status status);
-        void uuidChanged(QUuid uuid);
     
     private:
         QScopedPointer<JobPrivate> p;
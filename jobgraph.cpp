@@ -0,0 +1,239 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "jobgraph.h"
+
+#include <algorithm>
+
+// nodes hold both edge directions, dependson points to the parent and
+// dependents to the children, cascades only visit the affected subgraph.
+// evicted jobs leave a tombstone so a parent that is gone still resolves
+
+JobGraph::JobGraph()
+{
+}
+
+JobGraph::Node*
+JobGraph::insert(QSharedPointer<Job> job, const QUuid& dependson, quint64 sequence)
+{
+    QUuid uuid = job->uuid();
+    graves.remove(uuid);
+    Node& node = nodes[uuid];
+    node.job = job;
+    node.dependson = dependson;
+    node.dependents.clear();
+    node.sequence = sequence;
+    node.enqueued = 0;
+    node.state = isReady(dependson) ? Ready : Blocked;
+    if (!dependson.isNull()) {
+        auto it = nodes.find(dependson);
+        if (it != nodes.end() && !it->dependents.contains(uuid)) {
+            it->dependents.append(uuid);
+        }
+    }
+    return &node;
+}
+
+JobGraph::Node*
+JobGraph::node(const QUuid& uuid)
+{
+    auto it = nodes.find(uuid);
+    if (it == nodes.end()) {
+        return nullptr;
+    }
+    return &it.value();
+}
+
+const JobGraph::Node*
+JobGraph::node(const QUuid& uuid) const
+{
+    auto it = nodes.constFind(uuid);
+    if (it == nodes.constEnd()) {
+        return nullptr;
+    }
+    return &it.value();
+}
+
+QSharedPointer<Job>
+JobGraph::job(const QUuid& uuid) const
+{
+    const Node* found = node(uuid);
+    if (!found) {
+        return QSharedPointer<Job>();
+    }
+    return found->job;
+}
+
+bool
+JobGraph::contains(const QUuid& uuid) const
+{
+    return nodes.contains(uuid);
+}
+
+bool
+JobGraph::isReady(const QUuid& dependson) const
+{
+    if (dependson.isNull()) {
+        return true;
+    }
+    const Node* parent = node(dependson);
+    if (parent) {
+        return parent->state == Done;
+    }
+    const Tombstone* evicted = tombstone(dependson);
+    if (evicted) { // completed, skipped or failed by a dependent are done, as on restore
+        return evicted->status == Job::Completed || evicted->status == Job::Skipped || evicted->status == Job::Dependency;
+    }
+    return false;
+}
+
+bool
+JobGraph::isFailed(const QUuid& dependson) const
+{
+    if (dependson.isNull()) {
+        return false;
+    }
+    const Node* parent = node(dependson);
+    if (parent) {
+        return parent->state == Failed;
+    }
+    const Tombstone* evicted = tombstone(dependson);
+    return evicted && (evicted->status == Job::Failed || evicted->status == Job::Timeout);
+}
+
+QList<QUuid>
+JobGraph::dependents(const QUuid& uuid) const
+{
+    const Node* found = node(uuid);
+    if (!found) {
+        return QList<QUuid>();
+    }
+    return found->dependents;
+}
+
+QList<QUuid>
+JobGraph::descendants(const QUuid& uuid) const
+{
+    QList<QUuid> visited;
+    const Node* found = node(uuid);
+    if (!found) {
+        return visited;
+    }
+    visited = found->dependents;
+    for (int i = 0; i < visited.size(); ++i) { // breadth first, parents before children
+        const Node* child = node(visited[i]);
+        if (child) {
+            visited.append(child->dependents);
+        }
+    }
+    return visited;
+}
+
+QList<QUuid>
+JobGraph::ancestors(const QUuid& uuid) const
+{
+    QList<QUuid> visited;
+    const Node* found = node(uuid);
+    while (found && !found->dependson.isNull()) {
+        visited.append(found->dependson);
+        found = node(found->dependson);
+    }
+    return visited;
+}
+
+JobGraph::Node
+JobGraph::take(const QUuid& uuid)
+{
+    Node taken = nodes.take(uuid);
+    if (!taken.dependson.isNull()) {
+        auto it = nodes.find(taken.dependson);
+        if (it != nodes.end()) {
+            it->dependents.removeAll(uuid);
+        }
+    }
+    return taken;
+}
+
+JobGraph::Node
+JobGraph::bury(const QUuid& uuid, qint64 finished)
+{
+    Node taken = take(uuid);
+    if (taken.job) {
+        remember(uuid, Tombstone { taken.dependson, finished, taken.job->status() });
+    }
+    return taken;
+}
+
+void
+JobGraph::remember(const QUuid& uuid, const Tombstone& tombstone)
+{
+    graves.insert(uuid, tombstone);
+    burials.enqueue(qMakePair(uuid, tombstone.finished));
+    while (burials.size() > Tombstones) {
+        QPair<QUuid, qint64> oldest = burials.dequeue();
+        auto it = graves.find(oldest.first);
+        if (it != graves.end() && it->finished == oldest.second) { // not buried again since
+            graves.erase(it);
+        }
+    }
+}
+
+const JobGraph::Tombstone*
+JobGraph::tombstone(const QUuid& uuid) const
+{
+    auto it = graves.constFind(uuid);
+    if (it == graves.constEnd()) {
+        return nullptr;
+    }
+    return &it.value();
+}
+
+QList<QPair<QUuid, JobGraph::Tombstone>>
+JobGraph::tombstones() const
+{
+    // oldest first, remembering them in order restores the same graves
+    QList<QPair<QUuid, Tombstone>> tombstones;
+    tombstones.reserve(graves.size());
+    for (const QPair<QUuid, qint64>& burial : burials) {
+        auto grave = graves.constFind(burial.first);
+        if (grave != graves.constEnd() && grave->finished == burial.second) {
+            tombstones.append(qMakePair(burial.first, grave.value()));
+        }
+    }
+    return tombstones;
+}
+
+QList<QSharedPointer<Job>>
+JobGraph::jobs() const
+{
+    // submit order, parents always come before their dependents
+    QList<const Node*> ordered;
+    ordered.reserve(nodes.size());
+    for (const Node& node : nodes) {
+        ordered.append(&node);
+    }
+    std::sort(ordered.begin(), ordered.end(), [](const Node* a, const Node* b) {
+        return a->sequence < b->sequence;
+    });
+    QList<QSharedPointer<Job>> jobs;
+    jobs.reserve(ordered.size());
+    for (const Node* node : ordered) {
+        jobs.append(node->job);
+    }
+    return jobs;
+}
+
+int
+JobGraph::size() const
+{
+    return nodes.size();
+}
+
+void
+JobGraph::clear()
+{
+    nodes.clear();
+    graves.clear();
+    burials.clear();
+}
@@ -0,0 +1,73 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include "job.h"
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QQueue>
+#include <QSharedPointer>
+#include <QUuid>
+
+class JobGraph
+{
+    public:
+        enum State {
+            Blocked,
+            Ready,
+            Running,
+            Done,
+            Failed,
+            Stopped,
+            Delayed // backing off before a retry
+        };
+
+        struct Node {
+            QSharedPointer<Job> job;
+            QUuid dependson;
+            QList<QUuid> dependents;
+            quint64 sequence;
+            qint64 enqueued; // ms on the queue clock when last made ready
+            State state;
+        };
+
+        struct Tombstone {
+            QUuid dependson;
+            qint64 finished; // ms since epoch
+            Job::Status status;
+        };
+
+        enum {
+            Tombstones = 100000 // evicted jobs remembered, the oldest are forgotten first
+        };
+
+    public:
+        JobGraph();
+        Node* insert(QSharedPointer<Job> job, const QUuid& dependson, quint64 sequence);
+        Node* node(const QUuid& uuid);
+        const Node* node(const QUuid& uuid) const;
+        QSharedPointer<Job> job(const QUuid& uuid) const;
+        bool contains(const QUuid& uuid) const;
+        bool isReady(const QUuid& dependson) const;
+        bool isFailed(const QUuid& dependson) const;
+        QList<QUuid> dependents(const QUuid& uuid) const;
+        QList<QUuid> descendants(const QUuid& uuid) const;
+        QList<QUuid> ancestors(const QUuid& uuid) const;
+        Node take(const QUuid& uuid);
+        Node bury(const QUuid& uuid, qint64 finished);
+        void remember(const QUuid& uuid, const Tombstone& tombstone);
+        const Tombstone* tombstone(const QUuid& uuid) const;
+        QList<QPair<QUuid, Tombstone>> tombstones() const;
+        QList<QSharedPointer<Job>> jobs() const;
+        int size() const;
+        void clear();
+
+    private:
+        QHash<QUuid, Node> nodes;
+        QHash<QUuid, Tombstone> graves;
+        QQueue<QPair<QUuid, qint64>> burials; // oldest first, with when they finished
+};
@@ -0,0 +1,89 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "joblog.h"
+
+// a job log as the segments it was written in, appending never copies what is
+// already there and the text is only joined when someone reads it. an archived
+// log keeps a summary of the header and last status in memory, positions still
+// count the whole log so appends after archiving line up with what was shown
+
+JobLog::JobLog()
+: length(0)
+, changes(0)
+{
+}
+
+void
+JobLog::reset(const QString& header)
+{
+    list.clear();
+    list.append(Segment { Header, header });
+    length = header.size();
+    changes++;
+}
+
+qint64
+JobLog::append(Kind kind, const QString& text)
+{
+    qint64 position = length;
+    list.append(Segment { kind, text });
+    length += text.size();
+    changes++;
+    return position;
+}
+
+QString
+JobLog::text() const
+{
+    QString text;
+    text.reserve(length);
+    for (const Segment& segment : list) {
+        text += segment.text;
+    }
+    return text;
+}
+
+const QList<JobLog::Segment>&
+JobLog::segments() const
+{
+    return list;
+}
+
+qint64
+JobLog::size() const
+{
+    return length;
+}
+
+qint64
+JobLog::revision() const
+{
+    return changes;
+}
+
+bool
+JobLog::archive(qint64 revision)
+{
+    if (revision != changes || list.isEmpty()) {
+        return false; // changed since it was stored
+    }
+    QString summary = list.first().text;
+    for (int i = list.size() - 1; i > 0; --i) {
+        if (list[i].kind == Status) {
+            summary += list[i].text;
+            break;
+        }
+    }
+    list.clear();
+    list.append(Segment { Summary, summary });
+    changes++;
+    return true;
+}
+
+bool
+JobLog::isArchived() const
+{
+    return !list.isEmpty() && list.first().kind == Summary;
+}
@@ -0,0 +1,38 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include <QList>
+#include <QString>
+
+class JobLog
+{
+    public:
+        enum Kind {
+            Header,
+            Status,
+            Output,
+            Error,
+            Summary // stands in for an archived log
+        };
+        struct Segment {
+            Kind kind;
+            QString text;
+        };
+        JobLog();
+        void reset(const QString& header);
+        qint64 append(Kind kind, const QString& text);
+        QString text() const;
+        const QList<Segment>& segments() const;
+        qint64 size() const;
+        qint64 revision() const;
+        bool archive(qint64 revision);
+        bool isArchived() const;
+
+    private:
+        QList<Segment> list;
+        qint64 length; // of the whole log, archived text included
+        qint64 changes;
+};
@@ -3,6 +3,7 @@
 // https://github.com/mikaelsundell/jobman
 
 #include "jobman.h"
+#include "commandcache.h"
 #include "dropfilter.h"
 #include "error.h"
 #include "eventfilter.h"
@@ -14,6 +15,8 @@
 #include "process.h"
 #include "question.h"
 #include "queue.h"
+#include "spawner.h"
+#include "tuner.h"
 
 #include <QAction>
 #include <QDir>
@@ -33,6 +36,8 @@
 #include <QWindow>
 #include <QDebug>
 
+#include <cmath>
+
 // generated files
 #include "ui_about.h"
 #include "ui_jobman.h"
@@ -51,6 +56,9 @@ class JobmanPrivate : public QObject
         bool eventFilter(QObject* object, QEvent* event);
         void loadSettings();
         void saveSettings();
+        enum {
+            Interactive = 10 // files in a drop that still get the full weight
+        };
     
     public Q_SLOTS:
         void loadPresets();
@@ -69,6 +77,7 @@ class JobmanPrivate : public QObject
         void saveToChanged(const QString& text);
         void createFolderChanged(int state);
         void threadsChanged(int index);
+        void tunerChanged(int threads);
         void showAbout();
         void showPreferences();
         void openGithubReadme();
@@ -103,6 +112,7 @@ class JobmanPrivate : public QObject
         };
         QString replacePattern(const QString& input, const QString& pattern, const QFileInfo& inputinfo);
         QString replaceInput(const QString& input, const QFileInfo& inputinfo, const QFileInfo& outputinfo);
+        void tunePreset(QSharedPointer<Preset> preset);
         int width;
         int height;
         QSize size;
@@ -112,7 +122,9 @@ class JobmanPrivate : public QObject
         QString filesfrom;
         bool createfolders;
         QMap<QString, QList<QUuid>> processedfiles;
+        QString tunedpreset;
         QPointer<Queue> queue;
+        QScopedPointer<Tuner> tuner;
         QPointer<Jobman> window;
         QScopedPointer<About> about;
         QScopedPointer<Preferences> preferences;
@@ -140,8 +152,16 @@ JobmanPrivate::init()
     QString inputProfile = resources.filePath("sRGB2014.icc"); // built-in Qt input profile
     transform->setInputProfile(inputProfile);
     profile();
+    // commands, resolved and watched from the ui thread
+    CommandCache::instance();
+    // spawn helper, started while our footprint is small
+    Spawner::instance()->start(QApplication::applicationDirPath() + "/jobman-spawn");
     // queue
     queue = Queue::instance();
+    // tuner, adjusts threads in auto mode
+    tuner.reset(new Tuner());
+    tuner->setRange(1, QThread::idealThreadCount());
+    tuner->setThreads(qMax(1, QThread::idealThreadCount() / 2));
     // ui
     ui.reset(new Ui_Jobman());
     ui->setupUi(window);
@@ -191,12 +211,17 @@ JobmanPrivate::init()
     connect(ui->openGithubReadme, &QAction::triggered, this, &JobmanPrivate::openGithubReadme);
     connect(ui->openGithubIssues, &QAction::triggered, this, &JobmanPrivate::openGithubIssues);
     connect(queue.data(), &Queue::jobProcessed, this, &JobmanPrivate::jobProcessed);
+    connect(queue.data(), &Queue::jobProcessed, tuner.data(), &Tuner::jobProcessed);
+    connect(tuner.data(), &Tuner::threadsChanged, this, &JobmanPrivate::tunerChanged);
+    // jobs from the previous session, monitor is connected by now
+    queue->restore();
     size = window->size();
     // threads
     int threads = QThread::idealThreadCount();
     for (int i = 1; i <= threads; ++i) {
         ui->threads->addItem(QString::number(i), i);
     }
+    ui->threads->addItem("Auto", 0);
     // cpu
     QTimer *timer = new QTimer(window.data());
     QObject::connect(timer, &QTimer::timeout, [&]() {
@@ -354,6 +379,16 @@ JobmanPrivate::loadSettings()
     presetfrom = settings.value("presetFrom", presets).toString();
     saveto = settings.value("saveTo", documents).toString();
     createfolders = settings.value("createFolders", false).toBool();
+    // queue, priority points gained per minute of waiting
+    queue->setAging(settings.value("aging", 1).toInt());
+    // result cache size in megabytes, least recently used entries are evicted
+    queue->setCacheSize(settings.value("cacheSize", 1024).toInt());
+    // skip jobs whose output is newer than their input
+    queue->setIncremental(settings.value("incremental", false).toBool());
+    // prometheus metrics, a file path or unix:<socket path>, empty to turn off
+    queue->setMetrics(settings.value("metrics", "").toString(), settings.value("metricsInterval", 15).toInt());
+    // finished jobs kept before the oldest are evicted, by count and by age in hours, 0 keeps all, off by default
+    queue->setRetention(settings.value("retainJobs", 0).toInt(), settings.value("retainHours", 0).toInt());
     // ui
     setSaveto(saveto);
     ui->createFolders->setChecked(createfolders);
@@ -444,10 +479,32 @@ JobmanPrivate::run(const QList<QString>& files)
     QSharedPointer<Preset> preset = ui->presets->currentData().value<QSharedPointer<Preset>>();
     QString outputDir = saveto;
     processedfiles.clear();
-    int count = 0;
+    if (tuner->isEnabled()) {
+        tunePreset(preset);
+    }
+    // pools, limits set in preferences win over the preset
+    QSettings settings(MACOSX_BUNDLE_GUI_IDENTIFIER, "Jobman");
+    QMap<QString, int> poollimits;
+    for (const QString& pool : settings.value("pools", QStringList()).toStringList()) {
+        QStringList parts = pool.split(':');
+        if (parts.size() == 2) {
+            poollimits[parts[0].trimmed()] = qMax(0, parts[1].toInt());
+        }
+    }
+    for (const Task& task : preset->tasks()) {
+        if (!task.pool.isEmpty()) {
+            queue->setPool(task.pool, poollimits.value(task.pool, task.poollimit));
+        }
+    }
+    QList<QSharedPointer<Job>> jobs;
+    bool abandoned = false;
+    QUuid batch = QUuid::createUuid(); // each drop is scheduled fairly against the others
+    // a large drop is a backfill, its weight shrinks with its size so drops of a
+    // few files submitted while it runs get the larger share
+    double weight = qMin(1.0, std::sqrt(static_cast<double>(Interactive) / qMax(1, static_cast<int>(files.size()))));
     for(const QString& file : files) {
         QMap<QString, QUuid> jobuuids;
-        QList<QPair<QSharedPointer<Job>, QString>> dependentjobs;
+        QList<QPair<JobSpec, QString>> dependentjobs;
         
         QFileInfo inputinfo(file);
         for(const Task& task : preset->tasks()) {
@@ -474,54 +531,63 @@ JobmanPrivate::run(const QList<QString>& files)
                 argument = replaceInput(argument, inputinfo, outputinfo);
             }
             QString startin = replaceInput(task.startin, inputinfo, outputinfo);
-            QSharedPointer<Job> job(new Job());
-            {
-                job->setUuid(QUuid::createUuid());
-                job->setId(task.id);
-                job->setFilename(inputinfo.fileName());
-                job->setName(task.name);
-                job->setCommand(command);
-                job->setArguments(argumentlist);
-                job->setStartin(startin);
-                job->setStatus(Job::Waiting);
-            }
-            job->setOutput(outputdir);
+            JobSpec spec;
+            spec.uuid = QUuid::createUuid();
+            spec.batch = batch;
+            spec.id = task.id;
+            spec.filename = inputinfo.fileName();
+            spec.name = task.name;
+            spec.command = command;
+            spec.arguments = argumentlist;
+            spec.startin = startin;
+            spec.cpus = task.cpus;
+            spec.memory = task.memory;
+            spec.pool = task.pool;
+            spec.retry = task.retry;
+            spec.timeout = task.timeout;
+            spec.cputimeout = task.cputimeout;
+            spec.input = inputinfo.absoluteFilePath();
+            spec.preset = preset->name();
+            spec.outputfile = outputfile;
+            spec.cache = task.cache;
+            spec.weight = weight;
+            spec.output = outputdir;
             if (task.dependson.isEmpty()) {
-                QUuid uuid = queue->submit(job);
-                count++;
-                if (!processedfiles.contains(file)) {
-                    processedfiles.insert(file, QList<QUuid>());
-                }
-                processedfiles[file].append(uuid);
-                jobuuids[task.id] = uuid;
+                QSharedPointer<Job> job(new Job(spec));
+                jobs.append(job);
+                processedfiles[file].append(spec.uuid);
+                jobuuids[task.id] = spec.uuid;
             } else {
-                dependentjobs.append(qMakePair(job, task.dependson));
+                dependentjobs.append(qMakePair(spec, task.dependson));
             }
     
         }
-        for (QPair<QSharedPointer<Job>, QString> depedentjob : dependentjobs) {
-            QSharedPointer<Job> job = depedentjob.first;
-            QString dependentid = depedentjob.second;
+        for (QPair<JobSpec, QString> dependentjob : dependentjobs) {
+            JobSpec& spec = dependentjob.first;
+            QString dependentid = dependentjob.second;
             if (jobuuids.contains(dependentid)) {
-                job->setDependson(jobuuids[dependentid]);
-                QUuid uuid = queue->submit(job);
-                if (!processedfiles.contains(file)) {
-                    processedfiles.insert(file, QList<QUuid>());
-                }
-                processedfiles[file].append(uuid);
-                jobuuids[job->id()] = uuid;
-                count++;
+                spec.dependson = jobuuids[dependentid]; // the spec is complete once its parent is known
+                QSharedPointer<Job> job(new Job(spec));
+                jobs.append(job);
+                processedfiles[file].append(spec.uuid);
+                jobuuids[spec.id] = spec.uuid;
             } else {
+                QSharedPointer<Job> job(new Job(spec));
                 QString status = QString("Status:\n"
                                          "Dependency not found for job: %1\n")
                                          .arg(job->name());
                 job->setLog(status);
                 job->setStatus(Job::Failed);
-                return;
+                abandoned = true;
+                break;
             }
         }
+        if (abandoned) {
+            break; // the rest of the drop is abandoned, jobs before it still run
+        }
     }
-    ui->fileprogress->setMaximum(ui->fileprogress->maximum() + count);
+    queue->submit(jobs); // single batch, one lock and one dispatch
+    ui->fileprogress->setMaximum(ui->fileprogress->maximum() + jobs.size());
     if (!ui->fileprogress->isVisible()) {
         ui->fileprogress->show();
         ui->idleprogress->hide();
@@ -630,7 +696,44 @@ JobmanPrivate::createFolderChanged(int state)
 void
 JobmanPrivate::threadsChanged(int index)
 {
-    queue->setThreads(ui->threads->itemText(index).toInt());
+    int threads = ui->threads->itemData(index).toInt();
+    if (threads > 0) {
+        tuner->setEnabled(false);
+        queue->setThreads(threads);
+    } else {
+        if (ui->presets->count()) {
+            tunePreset(ui->presets->currentData().value<QSharedPointer<Preset>>());
+        }
+        tuner->setEnabled(true);
+        queue->setThreads(tuner->threads());
+    }
+}
+
+void
+JobmanPrivate::tunerChanged(int threads)
+{
+    queue->setThreads(threads);
+    if (!tunedpreset.isEmpty()) {
+        QSettings settings(MACOSX_BUNDLE_GUI_IDENTIFIER, "Jobman");
+        QVariantMap autothreads = settings.value("autoThreads").toMap();
+        autothreads[tunedpreset] = threads;
+        settings.setValue("autoThreads", autothreads);
+    }
+}
+
+void
+JobmanPrivate::tunePreset(QSharedPointer<Preset> preset)
+{
+    // start near the level last found for this preset
+    if (preset.isNull() || preset->filename() == tunedpreset) {
+        return;
+    }
+    tunedpreset = preset->filename();
+    QSettings settings(MACOSX_BUNDLE_GUI_IDENTIFIER, "Jobman");
+    QVariantMap autothreads = settings.value("autoThreads").toMap();
+    if (autothreads.contains(tunedpreset)) {
+        tuner->setThreads(autothreads[tunedpreset].toInt());
+    }
 }
 
 void
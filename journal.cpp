@@ -0,0 +1,350 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "journal.h"
+
+#include <QDir>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+#include <stdio.h>
+#include <unistd.h>
+
+// append-only log of queue changes, one compact json record per line. records
+// are buffered and written with a single fsync per flush, a torn last line
+// from a crash is ignored on replay. compaction writes the live jobs and the
+// tombstones of evicted jobs to a snapshot and starts an empty journal
+
+Journal::Journal()
+: count(0)
+{
+}
+
+Journal::~Journal()
+{
+    close();
+}
+
+bool
+Journal::open(const QString& directory)
+{
+    QMutexLocker locker(&mutex);
+    path = directory;
+    QDir().mkpath(path);
+    file.setFileName(journalFile());
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        qWarning() << "Could not open journal:" << file.fileName();
+        return false;
+    }
+    return true;
+}
+
+void
+Journal::close()
+{
+    flush();
+    QMutexLocker locker(&mutex);
+    file.close();
+}
+
+QList<QSharedPointer<Job>>
+Journal::replay(Tombstones* tombstones)
+{
+    QMutexLocker locker(&mutex);
+    QList<QSharedPointer<Job>> jobs;
+    QHash<QUuid, QSharedPointer<Job>> uuids;
+    QHash<QUuid, JobGraph::Tombstone> graves;
+    Tombstones buried;
+    count = 0;
+    for (const QString& filename : { snapshotFile(), journalFile() }) {
+        QFile input(filename);
+        if (!input.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        while (!input.atEnd()) {
+            QJsonObject json = QJsonDocument::fromJson(input.readLine()).object();
+            if (json.isEmpty()) {
+                continue; // torn write
+            }
+            QString op = json["op"].toString();
+            QUuid uuid = QUuid::fromString(json["uuid"].toString());
+            if (op == "submit" && !uuids.contains(uuid)) {
+                JobSpec spec;
+                spec.uuid = uuid;
+                spec.id = json["id"].toString();
+                spec.name = json["name"].toString();
+                spec.filename = json["filename"].toString();
+                spec.command = json["command"].toString();
+                for (const QJsonValue& argument : json["arguments"].toArray()) {
+                    spec.arguments.append(argument.toString());
+                }
+                spec.startin = json["startin"].toString();
+                spec.output = json["output"].toString();
+                spec.dependson = QUuid::fromString(json["dependson"].toString());
+                spec.batch = QUuid::fromString(json["batch"].toString());
+                spec.cpus = json["cpus"].toInt(1);
+                spec.memory = json["memory"].toInt();
+                spec.pool = json["pool"].toString();
+                spec.timeout = json["timeout"].toInt();
+                QJsonObject jsonretry = json["retry"].toObject();
+                Retry& retry = spec.retry;
+                retry.attempts = jsonretry["attempts"].toInt(retry.attempts);
+                retry.delay = jsonretry["delay"].toInt(retry.delay);
+                retry.multiplier = jsonretry["multiplier"].toDouble(retry.multiplier);
+                retry.maxdelay = jsonretry["maxdelay"].toInt(retry.maxdelay);
+                retry.jitter = jsonretry["jitter"].toDouble(retry.jitter);
+                for (const QJsonValue& exitcode : jsonretry["exitcodes"].toArray()) {
+                    retry.exitcodes.append(exitcode.toInt());
+                }
+                for (const QJsonValue& exitsignal : jsonretry["signals"].toArray()) {
+                    retry.exitsignals.append(exitsignal.toInt());
+                }
+                spec.cputimeout = json["cputimeout"].toInt();
+                spec.input = json["input"].toString();
+                spec.preset = json["preset"].toString();
+                spec.outputfile = json["outputfile"].toString();
+                spec.cache = json["cache"].toBool();
+                spec.weight = json["weight"].toDouble(1.0);
+                spec.created = QDateTime::fromString(json["created"].toString(), Qt::ISODateWithMs);
+                QSharedPointer<Job> job(new Job(spec));
+                job->setPriority(json["priority"].toInt());
+                job->setStatus(static_cast<Job::Status>(json["status"].toInt()));
+                jobs.append(job);
+                uuids.insert(uuid, job);
+            } else if (op == "evict") {
+                JobGraph::Tombstone tombstone {
+                    QUuid::fromString(json["dependson"].toString()),
+                    static_cast<qint64>(json["finished"].toDouble()),
+                    static_cast<Job::Status>(json["status"].toInt())
+                };
+                uuids.remove(uuid);
+                graves.insert(uuid, tombstone);
+                buried.append(qMakePair(uuid, tombstone));
+            } else if (op != "submit" && uuids.contains(uuid)) {
+                QSharedPointer<Job> job = uuids[uuid];
+                if (op == "status") {
+                    job->setStatus(static_cast<Job::Status>(json["status"].toInt()));
+                } else if (op == "priority") {
+                    job->setPriority(json["priority"].toInt());
+                } else if (op == "remove") {
+                    uuids.remove(uuid);
+                }
+            }
+            count++;
+        }
+    }
+    // a crash during compaction replays the old journal after the new snapshot,
+    // its records lead to the same final state so only the submits are skipped
+    QList<QSharedPointer<Job>> replayed;
+    replayed.reserve(uuids.size());
+    for (const QSharedPointer<Job>& job : jobs) {
+        if (uuids.contains(job->uuid())) {
+            replayed.append(job);
+        }
+    }
+    if (tombstones) {
+        tombstones->clear();
+        for (const auto& burial : buried) { // the old journal may repeat the snapshot
+            auto grave = graves.find(burial.first);
+            if (grave != graves.end()) {
+                tombstones->append(qMakePair(burial.first, grave.value()));
+                graves.erase(grave);
+            }
+        }
+    }
+    return replayed;
+}
+
+bool
+Journal::submitted(QSharedPointer<Job> job)
+{
+    return append(record(job));
+}
+
+bool
+Journal::statusChanged(const QUuid& uuid, Job::Status status)
+{
+    QJsonObject json;
+    json["op"] = "status";
+    json["uuid"] = uuid.toString();
+    json["status"] = static_cast<int>(status);
+    return append(QJsonDocument(json).toJson(QJsonDocument::Compact));
+}
+
+bool
+Journal::priorityChanged(const QUuid& uuid, int priority)
+{
+    QJsonObject json;
+    json["op"] = "priority";
+    json["uuid"] = uuid.toString();
+    json["priority"] = priority;
+    return append(QJsonDocument(json).toJson(QJsonDocument::Compact));
+}
+
+bool
+Journal::evicted(const QUuid& uuid, const JobGraph::Tombstone& tombstone)
+{
+    return append(record(uuid, tombstone));
+}
+
+bool
+Journal::removed(const QUuid& uuid)
+{
+    QJsonObject json;
+    json["op"] = "remove";
+    json["uuid"] = uuid.toString();
+    return append(QJsonDocument(json).toJson(QJsonDocument::Compact));
+}
+
+void
+Journal::flush()
+{
+    QMutexLocker locker(&mutex);
+    if (pending.isEmpty() || !file.isOpen()) {
+        return;
+    }
+    write(file, pending); // one fsync for the whole group
+    pending.clear();
+}
+
+bool
+Journal::compact(const QList<QSharedPointer<Job>>& jobs, const Tombstones& tombstones)
+{
+    // jobs must be collected after a flush, records still pending are newer
+    // than the snapshot and stay for the next flush
+    QByteArray data;
+    for (const auto& tombstone : tombstones) {
+        data += record(tombstone.first, tombstone.second) + '\n';
+    }
+    for (const QSharedPointer<Job>& job : jobs) {
+        data += record(job) + '\n'; // reads jobs without holding the journal
+    }
+    QMutexLocker locker(&mutex);
+    if (!file.isOpen()) {
+        return false;
+    }
+    QFile snapshot(snapshotFile() + ".tmp");
+    if (!snapshot.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    if (!write(snapshot, data)) {
+        snapshot.remove();
+        return false;
+    }
+    snapshot.close();
+    // rename replaces atomically, a crash leaves either the old or the new snapshot
+    if (::rename(QFile::encodeName(snapshot.fileName()).constData(), QFile::encodeName(snapshotFile()).constData()) != 0) {
+        return false;
+    }
+    file.resize(0);
+    count = tombstones.size() + jobs.size();
+    return true;
+}
+
+int
+Journal::records() const
+{
+    QMutexLocker locker(&mutex);
+    return count;
+}
+
+bool
+Journal::append(const QByteArray& record)
+{
+    QMutexLocker locker(&mutex);
+    if (!file.isOpen()) {
+        return false; // closed, nothing is recorded
+    }
+    bool first = pending.isEmpty();
+    pending += record;
+    pending += '\n';
+    count++;
+    return first; // caller schedules a flush for the group
+}
+
+bool
+Journal::write(QFile& output, const QByteArray& data)
+{
+    if (output.write(data) != data.size() || !output.flush()) {
+        qWarning() << "Could not write journal:" << output.fileName();
+        return false;
+    }
+    return ::fsync(output.handle()) == 0;
+}
+
+QByteArray
+Journal::record(QSharedPointer<Job> job) const
+{
+    QJsonObject json;
+    json["op"] = "submit";
+    json["uuid"] = job->uuid().toString();
+    json["id"] = job->id();
+    json["name"] = job->name();
+    json["filename"] = job->filename();
+    json["command"] = job->command();
+    json["arguments"] = QJsonArray::fromStringList(job->arguments());
+    json["startin"] = job->startin();
+    json["output"] = job->output();
+    json["dependson"] = job->dependson().toString();
+    json["batch"] = job->batch().toString();
+    json["priority"] = job->priority();
+    json["cpus"] = job->cpus();
+    json["memory"] = job->memory();
+    json["pool"] = job->pool();
+    json["timeout"] = job->timeout();
+    Retry retry = job->retry();
+    QJsonObject jsonretry;
+    jsonretry["attempts"] = retry.attempts;
+    jsonretry["delay"] = retry.delay;
+    jsonretry["multiplier"] = retry.multiplier;
+    jsonretry["maxdelay"] = retry.maxdelay;
+    jsonretry["jitter"] = retry.jitter;
+    QJsonArray exitcodes;
+    for (int exitcode : retry.exitcodes) {
+        exitcodes.append(exitcode);
+    }
+    jsonretry["exitcodes"] = exitcodes;
+    QJsonArray exitsignals;
+    for (int exitsignal : retry.exitsignals) {
+        exitsignals.append(exitsignal);
+    }
+    jsonretry["signals"] = exitsignals;
+    json["retry"] = jsonretry;
+    json["cputimeout"] = job->cputimeout();
+    json["input"] = job->input();
+    json["preset"] = job->preset();
+    json["outputfile"] = job->outputfile();
+    json["cache"] = job->cache();
+    json["weight"] = job->weight();
+    json["created"] = job->created().toString(Qt::ISODateWithMs);
+    json["status"] = static_cast<int>(job->status());
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+QByteArray
+Journal::record(const QUuid& uuid, const JobGraph::Tombstone& tombstone) const
+{
+    QJsonObject json;
+    json["op"] = "evict";
+    json["uuid"] = uuid.toString();
+    json["dependson"] = tombstone.dependson.toString();
+    json["status"] = static_cast<int>(tombstone.status);
+    json["finished"] = static_cast<double>(tombstone.finished);
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+QString
+Journal::snapshotFile() const
+{
+    return QDir(path).filePath("snapshot");
+}
+
+QString
+Journal::journalFile() const
+{
+    return QDir(path).filePath("journal");
+}
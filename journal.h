@@ -0,0 +1,48 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include "job.h"
+#include "jobgraph.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QString>
+#include <QUuid>
+
+class Journal
+{
+    public:
+        Journal();
+        ~Journal();
+        bool open(const QString& path);
+        void close();
+        typedef QList<QPair<QUuid, JobGraph::Tombstone>> Tombstones;
+        QList<QSharedPointer<Job>> replay(Tombstones* tombstones = nullptr);
+        bool submitted(QSharedPointer<Job> job);
+        bool statusChanged(const QUuid& uuid, Job::Status status);
+        bool priorityChanged(const QUuid& uuid, int priority);
+        bool removed(const QUuid& uuid);
+        bool evicted(const QUuid& uuid, const JobGraph::Tombstone& tombstone);
+        void flush();
+        bool compact(const QList<QSharedPointer<Job>>& jobs, const Tombstones& tombstones);
+        int records() const;
+
+    private:
+        bool append(const QByteArray& record);
+        bool write(QFile& file, const QByteArray& data);
+        QByteArray record(QSharedPointer<Job> job) const;
+        QByteArray record(const QUuid& uuid, const JobGraph::Tombstone& tombstone) const;
+        QString snapshotFile() const;
+        QString journalFile() const;
+        QString path;
+        QFile file;
+        QByteArray pending;
+        int count;
+        mutable QMutex mutex;
+};
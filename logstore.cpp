@@ -0,0 +1,190 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "logstore.h"
+
+#include <QSaveFile>
+#include <QtEndian>
+#include <QDebug>
+
+// logs of finished jobs, zlib compressed and appended to one file with an
+// in-memory index by uuid. each record starts with its uuid and size so the
+// index is rebuilt when the store is opened again, jobs restored from the
+// journal still find their logs. a torn last record is cut off. replaced and
+// removed logs leave dead records behind that are dropped by rewriting the
+// file once they outweigh the live ones
+
+LogStore::LogStore()
+: live(0)
+{
+}
+
+bool
+LogStore::open(const QString& filename)
+{
+    QMutexLocker locker(&mutex);
+    file.close();
+    file.setFileName(filename);
+    entries.clear();
+    live = 0;
+    if (!file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Could not open log store:" << filename;
+        return false;
+    }
+    // a later record of the same job replaces the earlier one
+    qint64 offset = 0;
+    while (offset + Header <= file.size()) {
+        if (!file.seek(offset)) {
+            break;
+        }
+        QByteArray header = file.read(Header);
+        if (header.size() != Header) {
+            break;
+        }
+        QUuid uuid = QUuid::fromRfc4122(header.left(16));
+        qint32 size = qFromBigEndian<qint32>(header.constData() + 16);
+        if (size < 0 || offset + Header + size > file.size()) {
+            break;
+        }
+        auto it = entries.find(uuid);
+        if (it != entries.end()) {
+            live -= it->size;
+        }
+        entries.insert(uuid, Entry { offset + Header, size });
+        live += size;
+        offset += Header + size;
+    }
+    if (offset < file.size()) {
+        qWarning() << "Log store truncated after a torn record:" << filename;
+        file.resize(offset);
+    }
+    return true;
+}
+
+bool
+LogStore::store(const QUuid& uuid, const QString& text)
+{
+    QByteArray data = qCompress(text.toUtf8(), 6); // compressed by the caller's thread, not under the lock
+    QMutexLocker locker(&mutex);
+    if (!file.isOpen()) {
+        return false;
+    }
+    qint64 offset = file.size();
+    QByteArray record = header(uuid, data.size()) + data;
+    if (!file.seek(offset) || file.write(record) != record.size()) {
+        file.resize(offset); // no torn record is left for the next open
+        return false;
+    }
+    auto it = entries.find(uuid);
+    if (it != entries.end()) {
+        live -= it->size;
+    }
+    entries.insert(uuid, Entry { offset + Header, static_cast<qint32>(data.size()) });
+    live += data.size();
+    if (file.size() - live > Compaction && file.size() - live > live) {
+        compact();
+    }
+    return true;
+}
+
+QString
+LogStore::load(const QUuid& uuid) const
+{
+    QByteArray data;
+    {
+        QMutexLocker locker(&mutex);
+        auto it = entries.constFind(uuid);
+        if (it == entries.constEnd() || !file.seek(it->offset)) {
+            return QString();
+        }
+        data = file.read(it->size);
+    }
+    return QString::fromUtf8(qUncompress(data));
+}
+
+bool
+LogStore::contains(const QUuid& uuid) const
+{
+    QMutexLocker locker(&mutex);
+    return entries.contains(uuid);
+}
+
+void
+LogStore::remove(const QUuid& uuid)
+{
+    QMutexLocker locker(&mutex);
+    auto it = entries.find(uuid);
+    if (it != entries.end()) {
+        live -= it->size;
+        entries.erase(it);
+    }
+}
+
+void
+LogStore::retain(const QSet<QUuid>& uuids)
+{
+    // logs of jobs no longer held, removed before the store was opened again
+    QMutexLocker locker(&mutex);
+    for (auto it = entries.begin(); it != entries.end(); ) {
+        if (uuids.contains(it.key())) {
+            ++it;
+        } else {
+            live -= it->size;
+            it = entries.erase(it);
+        }
+    }
+    if (file.size() - live > Compaction && file.size() - live > live) {
+        compact();
+    }
+}
+
+qint64
+LogStore::size() const
+{
+    QMutexLocker locker(&mutex);
+    return file.size();
+}
+
+void
+LogStore::compact()
+{
+    // live records are copied to a new file that replaces the old one
+    QSaveFile target(file.fileName());
+    if (!target.open(QIODevice::WriteOnly)) {
+        return;
+    }
+    QHash<QUuid, Entry> moved;
+    qint64 offset = 0;
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        if (!file.seek(it->offset)) {
+            return;
+        }
+        QByteArray data = file.read(it->size);
+        if (target.write(header(it.key(), it->size) + data) != Header + data.size()) {
+            return;
+        }
+        moved.insert(it.key(), Entry { offset + Header, it->size });
+        offset += Header + it->size;
+    }
+    if (!target.commit()) {
+        return;
+    }
+    file.close(); // the old file is gone, open the one that replaced it
+    if (!file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Could not reopen log store:" << file.fileName();
+        entries.clear();
+        live = 0;
+        return;
+    }
+    entries = moved;
+}
+
+QByteArray
+LogStore::header(const QUuid& uuid, qint32 size)
+{
+    QByteArray header = uuid.toRfc4122();
+    header.resize(Header);
+    qToBigEndian<qint32>(size, header.data() + 16);
+    return header;
+}
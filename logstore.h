@@ -0,0 +1,41 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QUuid>
+
+class LogStore
+{
+    public:
+        LogStore();
+        bool open(const QString& filename);
+        bool store(const QUuid& uuid, const QString& text);
+        QString load(const QUuid& uuid) const;
+        bool contains(const QUuid& uuid) const;
+        void remove(const QUuid& uuid);
+        void retain(const QSet<QUuid>& uuids);
+        qint64 size() const;
+
+    private:
+        enum {
+            Compaction = 64 * 1024 * 1024, // bytes of dead records before the file is rewritten
+            Header = 20 // uuid and size in front of each record
+        };
+        struct Entry {
+            qint64 offset;
+            qint32 size; // of the compressed log, after its header
+        };
+        void compact();
+        static QByteArray header(const QUuid& uuid, qint32 size);
+        mutable QFile file;
+        QHash<QUuid, Entry> entries;
+        qint64 live;
+        mutable QMutex mutex;
+};
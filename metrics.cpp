@@ -0,0 +1,340 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "metrics.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+// counters, gauges and histograms rendered in the prometheus text format. the
+// exposition is written to a file for a textfile collector or served as a
+// plain http response on a unix socket, the socket always answers with the
+// last published exposition so a scrape never waits on the queue
+
+Metrics::Metrics()
+: server(-1)
+{
+}
+
+Metrics::~Metrics()
+{
+    close();
+}
+
+void
+Metrics::counter(const QString& name, const QString& help)
+{
+    add(name, Counter, help, QList<double>());
+}
+
+void
+Metrics::gauge(const QString& name, const QString& help)
+{
+    add(name, Gauge, help, QList<double>());
+}
+
+void
+Metrics::histogram(const QString& name, const QString& help, const QList<double>& bounds)
+{
+    add(name, Histogram, help, bounds);
+}
+
+void
+Metrics::add(const QString& name, Type type, const QString& help, const QList<double>& bounds)
+{
+    QMutexLocker locker(&mutex);
+    Family& family = families[name];
+    family.type = type;
+    family.help = help;
+    family.bounds = bounds;
+}
+
+void
+Metrics::increment(const QString& name, const Labels& labels, double value)
+{
+    QMutexLocker locker(&mutex);
+    auto it = families.find(name);
+    if (it != families.end()) {
+        it->series[format(labels)].value += value;
+    }
+}
+
+void
+Metrics::set(const QString& name, double value, const Labels& labels)
+{
+    QMutexLocker locker(&mutex);
+    auto it = families.find(name);
+    if (it != families.end()) {
+        it->series[format(labels)].value = value;
+    }
+}
+
+void
+Metrics::observe(const QString& name, double value, const Labels& labels)
+{
+    QMutexLocker locker(&mutex);
+    auto it = families.find(name);
+    if (it == families.end()) {
+        return;
+    }
+    Series& series = it->series[format(labels)];
+    if (series.buckets.isEmpty()) {
+        series.buckets.resize(it->bounds.size());
+    }
+    int bucket = std::lower_bound(it->bounds.begin(), it->bounds.end(), value) - it->bounds.begin();
+    if (bucket < series.buckets.size()) {
+        series.buckets[bucket]++; // larger values only count towards +Inf
+    }
+    series.sum += value;
+    series.count++;
+}
+
+QByteArray
+Metrics::exposition() const
+{
+    QMutexLocker locker(&mutex);
+    static const char* types[] = { "counter", "gauge", "histogram" };
+    QString text;
+    for (auto family = families.constBegin(); family != families.constEnd(); ++family) {
+        const QString& name = family.key();
+        text += QString("# HELP %1 %2\n").arg(name).arg(family->help);
+        text += QString("# TYPE %1 %2\n").arg(name).arg(types[family->type]);
+        for (auto series = family->series.constBegin(); series != family->series.constEnd(); ++series) {
+            const QString& labels = series.key();
+            if (family->type != Histogram) {
+                text += QString("%1%2 %3\n")
+                        .arg(name)
+                        .arg(labels.isEmpty() ? QString() : QString("{%1}").arg(labels))
+                        .arg(number(series->value));
+                continue;
+            }
+            QString prefix = labels.isEmpty() ? QString() : labels + ",";
+            quint64 cumulative = 0;
+            for (int i = 0; i < family->bounds.size(); ++i) {
+                cumulative += series->buckets.value(i);
+                text += QString("%1_bucket{%2le=\"%3\"} %4\n").arg(name).arg(prefix).arg(number(family->bounds[i])).arg(cumulative);
+            }
+            text += QString("%1_bucket{%2le=\"+Inf\"} %3\n").arg(name).arg(prefix).arg(series->count);
+            QString braces = labels.isEmpty() ? QString() : QString("{%1}").arg(labels);
+            text += QString("%1_sum%2 %3\n").arg(name).arg(braces).arg(number(series->sum));
+            text += QString("%1_count%2 %3\n").arg(name).arg(braces).arg(series->count);
+        }
+    }
+    return text.toUtf8();
+}
+
+bool
+Metrics::write(const QString& filename) const
+{
+    // replaced atomically, a collector never reads half an exposition
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write metrics:" << filename;
+        return false;
+    }
+    file.write(exposition());
+    return file.commit();
+}
+
+bool
+Metrics::listen(const QString& path)
+{
+    close();
+    QByteArray name = QFile::encodeName(path);
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (name.size() >= static_cast<int>(sizeof(address.sun_path))) {
+        qWarning() << "Metrics socket path is too long:" << path;
+        return false;
+    }
+    memcpy(address.sun_path, name.constData(), name.size());
+    server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server == -1) {
+        return false;
+    }
+    fcntl(server, F_SETFD, FD_CLOEXEC);
+    fcntl(server, F_SETFL, fcntl(server, F_GETFL) | O_NONBLOCK);
+    ::unlink(name.constData()); // stale socket from an earlier run
+    if (::bind(server, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1 || ::listen(server, 16) == -1) {
+        qWarning() << "Could not listen on metrics socket:" << path << strerror(errno);
+        ::close(server);
+        server = -1;
+        return false;
+    }
+    socketpath = path;
+    notifier.reset(new QSocketNotifier(server, QSocketNotifier::Read));
+    QObject::connect(notifier.data(), &QSocketNotifier::activated, [this]() {
+        accept();
+    });
+    return true;
+}
+
+void
+Metrics::publish()
+{
+    QByteArray text = exposition();
+    {
+        QMutexLocker locker(&mutex);
+        published = text;
+    }
+    sweep(); // on the interval, a stalled scraper isn't kept until the next one connects
+}
+
+void
+Metrics::close()
+{
+    for (int fd : clients.keys()) {
+        disconnect(fd);
+    }
+    notifier.reset();
+    if (server != -1) {
+        ::close(server);
+        server = -1;
+        ::unlink(QFile::encodeName(socketpath).constData());
+    }
+}
+
+void
+Metrics::sweep()
+{
+    // scrapers that stopped reading are dropped, they can't hold a descriptor for long
+    for (auto it = clients.constBegin(); it != clients.constEnd(); ) {
+        int fd = it.key();
+        bool expired = it.value()->connected.hasExpired(Timeout);
+        ++it;
+        if (expired) {
+            disconnect(fd);
+        }
+    }
+}
+
+void
+Metrics::accept()
+{
+    sweep();
+    while (true) {
+        int fd = ::accept(server, nullptr, nullptr);
+        if (fd == -1) {
+            return; // EAGAIN, nothing more pending
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#if defined(SO_NOSIGPIPE)
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        // answer once the request arrived, closing with it unread would reset the connection
+        Client* client = new Client();
+        client->connected.start();
+        client->reader = new QSocketNotifier(fd, QSocketNotifier::Read);
+        QObject::connect(client->reader, &QSocketNotifier::activated, [this, fd]() {
+            respond(fd);
+        });
+        clients.insert(fd, client);
+    }
+}
+
+void
+Metrics::respond(int fd)
+{
+    Client* client = clients.value(fd);
+    if (!client) {
+        return;
+    }
+    char request[4096];
+    while (::read(fd, request, sizeof(request)) > 0) {}
+    QByteArray body;
+    {
+        QMutexLocker locker(&mutex);
+        body = published;
+    }
+    client->pending = QByteArray("HTTP/1.0 200 OK\r\n"
+                                 "Content-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: ") + QByteArray::number(body.size()) + "\r\n\r\n" + body;
+    client->reader->setEnabled(false);
+    // sent as the socket takes it, a slow scraper never blocks the queue thread
+    client->writer = new QSocketNotifier(fd, QSocketNotifier::Write);
+    QObject::connect(client->writer, &QSocketNotifier::activated, [this, fd]() {
+        drain(fd);
+    });
+    drain(fd);
+}
+
+void
+Metrics::drain(int fd)
+{
+    Client* client = clients.value(fd);
+    if (!client) {
+        return;
+    }
+    while (!client->pending.isEmpty()) {
+#if defined(MSG_NOSIGNAL)
+        ssize_t written = ::send(fd, client->pending.constData(), client->pending.size(), MSG_NOSIGNAL); // a scraper that went away must not raise SIGPIPE
+#else
+        ssize_t written = ::send(fd, client->pending.constData(), client->pending.size(), 0);
+#endif
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return; // the write notifier calls again once there's room
+        }
+        if (written <= 0) {
+            break;
+        }
+        client->pending.remove(0, written);
+    }
+    ::shutdown(fd, SHUT_WR);
+    disconnect(fd);
+}
+
+void
+Metrics::disconnect(int fd)
+{
+    Client* client = clients.take(fd);
+    if (!client) {
+        return;
+    }
+    // often called from the client's own activated signal
+    for (QSocketNotifier* socket : { client->reader, client->writer }) {
+        if (socket) {
+            socket->setEnabled(false);
+            socket->deleteLater();
+        }
+    }
+    delete client;
+    ::close(fd);
+}
+
+QString
+Metrics::format(const Labels& labels)
+{
+    QStringList parts;
+    for (const auto& label : labels) {
+        QString value = label.second;
+        value.replace("\\", "\\\\").replace("\"", "\\\"").replace("\n", "\\n");
+        parts << QString("%1=\"%2\"").arg(label.first).arg(value);
+    }
+    return parts.join(',');
+}
+
+QString
+Metrics::number(double value)
+{
+    if (std::isinf(value)) {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+    return QString::number(value, 'g', 12);
+}
@@ -0,0 +1,79 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QPair>
+#include <QScopedPointer>
+#include <QSocketNotifier>
+#include <QString>
+#include <QVector>
+
+class Metrics
+{
+    public:
+        typedef QList<QPair<QString, QString>> Labels;
+        Metrics();
+        ~Metrics();
+        void counter(const QString& name, const QString& help);
+        void gauge(const QString& name, const QString& help);
+        void histogram(const QString& name, const QString& help, const QList<double>& bounds);
+        void increment(const QString& name, const Labels& labels = Labels(), double value = 1);
+        void set(const QString& name, double value, const Labels& labels = Labels());
+        void observe(const QString& name, double value, const Labels& labels = Labels());
+        QByteArray exposition() const;
+        bool write(const QString& filename) const;
+        bool listen(const QString& path);
+        void publish();
+        void close();
+
+    private:
+        enum {
+            Timeout = 10000 // ms a scraper has to read its response
+        };
+        enum Type {
+            Counter,
+            Gauge,
+            Histogram
+        };
+        struct Series {
+            double value = 0;
+            QVector<quint64> buckets; // per bound, not cumulative
+            double sum = 0;
+            quint64 count = 0;
+        };
+        struct Client {
+            QSocketNotifier* reader = nullptr;
+            QSocketNotifier* writer = nullptr;
+            QByteArray pending; // response not yet sent
+            QElapsedTimer connected;
+        };
+        struct Family {
+            Type type;
+            QString help;
+            QList<double> bounds;
+            QMap<QString, Series> series; // by formatted labels
+        };
+        void add(const QString& name, Type type, const QString& help, const QList<double>& bounds);
+        static QString format(const Labels& labels);
+        static QString number(double value);
+        void sweep();
+        void accept();
+        void respond(int fd);
+        void drain(int fd);
+        void disconnect(int fd);
+        QMap<QString, Family> families;
+        QByteArray published;
+        QString socketpath;
+        int server;
+        QScopedPointer<QSocketNotifier> notifier;
+        QHash<int, Client*> clients;
+        mutable QMutex mutex;
+};
@@ -8,14 +8,17 @@
 
 #include <QDateTime>
 #include <QElapsedTimer>
+#include <QFileDialog>
 #include <QMenu>
 #include <QPainter>
 #include <QPointer>
 #include <QProgressBar>
+#include <QSet>
 #include <QSharedPointer>
 #include <QTimer>
 #include <QTreeWidgetItem>
 #include <QStyledItemDelegate>
+#include <QTextCursor>
 
 #include <QDebug>
 
@@ -49,17 +52,22 @@ class MonitorPrivate : public QObject
         MonitorPrivate();
         void init();
         void updateJob(const QUuid& uuid);
+        void updateItem(QTreeWidgetItem* item);
+        QTreeWidgetItem* addJob(QSharedPointer<Job> job);
         void updateProgress(QTreeWidgetItem* item);
         void updatePriority(Priority priority);
         void updateMetrics();
+        void updateAging();
         bool eventFilter(QObject* object, QEvent* event);
     
     public Q_SLOTS:
-        void jobSubmitted(QSharedPointer<Job> job);
+        void jobsSubmitted(const QList<QSharedPointer<Job>>& jobs);
         void jobRemoved(const QUuid& uuid);
+        void logAppended(qint64 position, const QString& text);
         void logChanged(const QString& log);
         void priorityChanged(int priority);
         void statusChanged(Job::Status status);
+        void duplicateofChanged(QUuid duplicateof);
         void selectionChanged();
         void toggleButtons();
         void start();
@@ -73,6 +81,8 @@ class MonitorPrivate : public QObject
         void cleanup();
         void close();
         void showMenu(const QPoint& pos);
+        void showOriginal();
+        void exportTrace();
 
     public:
         class StatusDelegate : public QStyledItemDelegate {
@@ -94,9 +104,11 @@ class MonitorPrivate : public QObject
                             color = transform->map(QColor::fromHsl(309, 150, 50).rgb());
                     } else if (status == "Stopped") {
                             color = transform->map(QColor::fromHsl(309, 90, 40).rgb());
+                    } else if (status == "Timeout") {
+                            color = transform->map(QColor::fromHsl(30, 150, 45).rgb());
                     } else if (status == "Running") {
                         color = transform->map(QColor::fromHsl(120, 150, 50).rgb());
-                    } else if (status == "Completed") {
+                    } else if (status == "Completed" || status == "Skipped") {
                         color = transform->map(QColor::fromHsl(120, 90, 40).rgb());
                     } else {
                         color = Qt::transparent;
@@ -146,6 +158,10 @@ class MonitorPrivate : public QObject
                             text = QString::number(value);  // Display the number itself if it doesn't match any priority
                             break;
                     }
+                    QVariant effective = index.data(Qt::UserRole); // aged while waiting
+                    if (effective.isValid() && effective.toInt() != value) {
+                        text += QString(" (%1)").arg(effective.toInt());
+                    }
                     opt.widget->style()->drawPrimitive(QStyle::PE_PanelItemViewItem, &opt, painter, opt.widget);
                     painter->save();
                     painter->setPen(opt.palette.color(QPalette::Text));
@@ -202,14 +218,20 @@ class MonitorPrivate : public QObject
         QTreeWidgetItem* findTopLevelItem(QTreeWidgetItem* item);
         QTreeWidgetItem* findItemByUuid(const QUuid& uuid);
         QSharedPointer<Job> itemJob(QTreeWidgetItem* item);
+        void showLog(QSharedPointer<Job> job);
         QSize size;
         QHash<QUuid, QTreeWidgetItem*> jobs;
+        QSet<QUuid> aged;
+        QPointer<QTimer> aging;
+        QUuid shownjob; // job whose log is shown, appended to as it grows
+        qint64 shown;
         QPointer<Queue> queue;
         QPointer<Monitor> dialog;
         QScopedPointer<Ui_Monitor> ui;
 };
 
 MonitorPrivate::MonitorPrivate()
+: shown(0)
 {
     qRegisterMetaType<QSharedPointer<Job>>("QSharedPointer<Job>");
 }
@@ -241,6 +263,10 @@ MonitorPrivate::init()
     ui->items->setItemDelegateForColumn(3, new PriorityDelegate(ui->items));
     ui->items->setItemDelegateForColumn(4, new StatusDelegate(ui->items));
     ui->items->setContextMenuPolicy(Qt::CustomContextMenu);
+    // aging, effective priorities only refresh while visible
+    aging = new QTimer(this);
+    aging->setInterval(5000);
+    connect(aging, &QTimer::timeout, this, &MonitorPrivate::updateAging);
     // event filter
     dialog->installEventFilter(this);
     // layout
@@ -257,7 +283,7 @@ MonitorPrivate::init()
     connect(ui->close, &QPushButton::pressed, this, &MonitorPrivate::close);
     connect(ui->items, &JobTree::itemSelectionChanged, this, &MonitorPrivate::selectionChanged);
     connect(ui->items, &QTreeWidget::customContextMenuRequested, this, &MonitorPrivate::showMenu);
-    connect(queue.data(), &Queue::jobSubmitted, this, &MonitorPrivate::jobSubmitted);
+    connect(queue.data(), &Queue::jobsSubmitted, this, &MonitorPrivate::jobsSubmitted);
     connect(queue.data(), &Queue::jobRemoved, this, &MonitorPrivate::jobRemoved);
 }
 
@@ -265,60 +291,88 @@ void
 MonitorPrivate::updateJob(const QUuid& uuid)
 {
     QTreeWidgetItem* item = findItemByUuid(uuid);
-    QVariant data = item->data(0, Qt::UserRole);
-    QSharedPointer<Job> itemjob = data.value<QSharedPointer<Job>>();
-    if (itemjob->uuid() == uuid) {
-        item->setText(Name, itemjob->name());
-        item->setText(Filename, itemjob->filename());
-        item->setText(Created, itemjob->created().toString("yyyy-MM-dd HH:mm:ss"));
-        item->setText(Priority_, QString::number(itemjob->priority()));
-        switch(itemjob->status())
-        {
-            case Job::Waiting: {
-                item->setText(Status, "Waiting");
-            }
-            break;
-            case Job::Running: {
-                item->setText(Status, "Running");
-            }
-            break;
-            case Job::Completed: {
-                item->setText(Status, "Completed");
-            }
-            break;
-            case Job::Dependency: {
-                item->setText(Status, "Dependency");
-            }
-            break;
-            case Job::Failed: {
-                item->setText(Status, "Failed");
-            }
-            break;
-            case Job::Stopped: {
-                item->setText(Status, "Stopped");
-            }
-            break;
+    updateItem(item);
+    updateProgress(item);
+    updateMetrics();
+    if (shownjob == uuid) {
+        showLog(itemJob(item));
+    }
+    toggleButtons();
+}
+
+void
+MonitorPrivate::updateItem(QTreeWidgetItem* item)
+{
+    QSharedPointer<Job> itemjob = itemJob(item);
+    item->setText(Name, itemjob->name());
+    QUuid duplicateof = itemjob->duplicateof();
+    if (!duplicateof.isNull()) { // follows an identical job submitted earlier
+        item->setText(Name, QString("%1 (duplicate)").arg(itemjob->name()));
+        QTreeWidgetItem* original = jobs.value(duplicateof, nullptr);
+        QString tooltip = QString("Duplicate of %1").arg(duplicateof.toString());
+        if (original) {
+            QSharedPointer<Job> originaljob = itemJob(original);
+            tooltip = QString("Duplicate of %1, %2 created %3")
+                      .arg(originaljob->name())
+                      .arg(originaljob->filename())
+                      .arg(originaljob->created().toString("yyyy-MM-dd HH:mm:ss"));
         }
-        QWidget* widget = ui->items->itemWidget(item, Progress);
-        if (!item->parent()) {
-            if (widget) {
-                QProgressBar* progress = widget->findChild<QProgressBar*>("progress");
-                progress->setValue(50);
-            } else {
-                QWidget* container = new QWidget(ui->items);
-                Ui::ProgressBar progressbar;
-                progressbar.setupUi(container);
-                progressbar.progress->setValue(50);
-                progressbar.spinner->setVisible(false);
-                ui->items->setItemWidget(item, Progress, container);
-            }
+        item->setToolTip(Name, tooltip);
+    } else {
+        item->setToolTip(Name, QString());
+    }
+    item->setText(Filename, itemjob->filename());
+    item->setText(Created, itemjob->created().toString("yyyy-MM-dd HH:mm:ss"));
+    item->setText(Priority_, QString::number(itemjob->priority()));
+    switch(itemjob->status())
+    {
+        case Job::Waiting: {
+            item->setText(Status, "Waiting");
         }
-        updateProgress(item);
-        if (item->isSelected()) {
-            ui->job->setText(itemjob->log());
+        break;
+        case Job::Running: {
+            item->setText(Status, "Running");
+        }
+        break;
+        case Job::Completed: {
+            item->setText(Status, "Completed");
+        }
+        break;
+        case Job::Dependency: {
+            item->setText(Status, "Dependency");
+        }
+        break;
+        case Job::Failed: {
+            item->setText(Status, "Failed");
+        }
+        break;
+        case Job::Stopped: {
+            item->setText(Status, "Stopped");
+        }
+        break;
+        case Job::Timeout: {
+            item->setText(Status, "Timeout");
+        }
+        break;
+        case Job::Skipped: {
+            item->setText(Status, "Skipped");
+        }
+        break;
+    }
+    QWidget* widget = ui->items->itemWidget(item, Progress);
+    if (!item->parent()) {
+        if (widget) {
+            QProgressBar* progress = widget->findChild<QProgressBar*>("progress");
+            progress->setValue(50);
+        } else {
+            QWidget* container = new QWidget(ui->items);
+            Ui::ProgressBar progressbar;
+            progressbar.setupUi(container);
+            progressbar.progress->setValue(50);
+            progressbar.spinner->setVisible(false);
+            ui->items->setItemWidget(item, Progress, container);
         }
     }
-    toggleButtons();
 }
                    
 void
@@ -335,7 +389,9 @@ MonitorPrivate::updateProgress(QTreeWidgetItem* item)
         }
         if (job->status() == Job::Completed ||
             job->status() == Job::Failed ||
-            job->status() == Job::Stopped) {
+            job->status() == Job::Stopped ||
+            job->status() == Job::Timeout ||
+            job->status() == Job::Skipped) {
             items++;
         }
         for (int i = 0; i < parentItem->childCount(); ++i) {
@@ -357,7 +413,6 @@ MonitorPrivate::updateProgress(QTreeWidgetItem* item)
     } else {
         spinner->hide();
     }
-    updateMetrics();
 }
 
 void
@@ -387,6 +442,8 @@ MonitorPrivate::updateMetrics()
     int stoppedCount = 0;
     int runningCount = 0;
     int failedCount = 0;
+    int timeoutCount = 0;
+    int skippedCount = 0;
     for (auto it = jobs.constBegin(); it != jobs.constEnd(); ++it) {
         QTreeWidgetItem* item = it.value();
         QVariant data = item->data(0, Qt::UserRole);
@@ -410,6 +467,12 @@ MonitorPrivate::updateMetrics()
             case Job::Stopped:
                 stoppedCount++;
                 break;
+            case Job::Timeout:
+                timeoutCount++;
+                break;
+            case Job::Skipped:
+                skippedCount++;
+                break;
             default:
                 break;
         }
@@ -420,6 +483,8 @@ MonitorPrivate::updateMetrics()
     if (completedCount > 0) parts << QString("completed: %1").arg(completedCount);
     if (stoppedCount > 0) parts << QString("stopped: %1").arg(stoppedCount);
     if (failedCount > 0) parts << QString("failed: %1").arg(failedCount);
+    if (timeoutCount > 0) parts << QString("timed out: %1").arg(timeoutCount);
+    if (skippedCount > 0) parts << QString("up to date: %1").arg(skippedCount);
     QString text = parts.join(", ");
     QString metricsText = QString("Files: %1").arg(ui->items->topLevelItemCount());
     if (!text.isEmpty()) {
@@ -438,17 +503,22 @@ MonitorPrivate::eventFilter(QObject* object, QEvent* event)
         int logHeight = height - jobsHeight;
         sizes << jobsHeight << logHeight;
         ui->splitter->setSizes(sizes);
+        updateAging();
+        aging->start();
+    }
+    if (event->type() == QEvent::Hide) {
+        aging->stop();
     }
     return false;
 }
 
-void
-MonitorPrivate::jobSubmitted(QSharedPointer<Job> job)
+QTreeWidgetItem*
+MonitorPrivate::addJob(QSharedPointer<Job> job)
 {
     QTreeWidgetItem* parent = nullptr;
     QUuid dependsonUuid = job->dependson();
     if (!dependsonUuid.isNull()) {
-        parent = findItemByUuid(dependsonUuid);
+        parent = jobs.value(dependsonUuid, nullptr);
     }
     QTreeWidgetItem* item = new QTreeWidgetItem();
     item->setData(0, Qt::UserRole, QVariant::fromValue(job));
@@ -458,50 +528,101 @@ MonitorPrivate::jobSubmitted(QSharedPointer<Job> job)
         ui->items->addTopLevelItem(item);
     }
     // connect
+    connect(job.data(), &Job::logAppended, this, &MonitorPrivate::logAppended, Qt::QueuedConnection);
     connect(job.data(), &Job::logChanged, this, &MonitorPrivate::logChanged, Qt::QueuedConnection);
     connect(job.data(), &Job::priorityChanged, this, &MonitorPrivate::priorityChanged, Qt::QueuedConnection);
     connect(job.data(), &Job::statusChanged, this, &MonitorPrivate::statusChanged, Qt::QueuedConnection);
-    // update
+    connect(job.data(), &Job::duplicateofChanged, this, &MonitorPrivate::duplicateofChanged, Qt::QueuedConnection);
     jobs.insert(job->uuid(), item);
+    updateItem(item);
+    return item;
+}
+
+void
+MonitorPrivate::updateAging()
+{
+    QHash<QUuid, int> priorities = queue->effectivePriorities();
+    for (const QUuid& uuid : aged) {
+        if (!priorities.contains(uuid) && jobs.contains(uuid)) {
+            jobs[uuid]->setData(Priority_, Qt::UserRole, QVariant());
+        }
+    }
+    aged.clear();
+    for (auto it = priorities.constBegin(); it != priorities.constEnd(); ++it) {
+        auto item = jobs.constFind(it.key());
+        if (item != jobs.constEnd()) {
+            item.value()->setData(Priority_, Qt::UserRole, it.value());
+            aged.insert(it.key());
+        }
+    }
+}
+
+void
+MonitorPrivate::jobsSubmitted(const QList<QSharedPointer<Job>>& submitted)
+{
+    QSet<QTreeWidgetItem*> topLevelItems;
+    ui->items->setUpdatesEnabled(false);
+    for (const QSharedPointer<Job>& job : submitted) {
+        topLevelItems.insert(findTopLevelItem(addJob(job)));
+    }
+    for (QTreeWidgetItem* topLevelItem : topLevelItems) {
+        updateProgress(topLevelItem);
+    }
+    ui->items->setUpdatesEnabled(true);
     updateMetrics();
-    updateJob(job->uuid());
+    toggleButtons();
 }
 
 void
 MonitorPrivate::jobRemoved(const QUuid& uuid)
 {
-    verifyItems([this, &uuid](QTreeWidgetItem* item, const QSharedPointer<Job>& job) -> bool {
-        if (job->uuid() == uuid) {
-            if (item->isSelected()) {
-                item->setSelected(false);
-            }
-            QTreeWidgetItem* parent = item->parent();
-            if (parent) {
-                parent->removeChild(item);
-                delete item;
-            } else {
-                int index = ui->items->indexOfTopLevelItem(item);
-                if (index != -1) {
-                    delete ui->items->takeTopLevelItem(index);
-                }
+    // children are removed before their parents, evicted trees come in bulk
+    QTreeWidgetItem* item = jobs.take(uuid);
+    if (item) {
+        if (item->isSelected()) {
+            item->setSelected(false);
+        }
+        QTreeWidgetItem* parent = item->parent();
+        if (parent) {
+            parent->removeChild(item);
+            delete item;
+        } else {
+            int index = ui->items->indexOfTopLevelItem(item);
+            if (index != -1) {
+                delete ui->items->takeTopLevelItem(index);
             }
-            jobs.remove(uuid);
-            return true;
         }
-        return false;
-    });
+    }
     updateMetrics();
 }
 
+void
+MonitorPrivate::logAppended(qint64 position, const QString& text)
+{
+    Job* job = qobject_cast<Job*>(sender());
+    if (job->uuid() != shownjob || position + text.size() <= shown) {
+        return; // not shown or already part of what is
+    }
+    if (position != shown) { // missed a change, read it whole
+        QTreeWidgetItem* item = jobs.value(shownjob, nullptr);
+        if (item) {
+            showLog(itemJob(item));
+        }
+        return;
+    }
+    QTextCursor cursor(ui->job->document());
+    cursor.movePosition(QTextCursor::End);
+    cursor.insertText(text);
+    shown += text.size();
+}
+
 void
 MonitorPrivate::logChanged(const QString& log)
 {
     QUuid uuid = qobject_cast<Job*>(sender())->uuid();
-    if (jobs.contains(uuid)) {
-        QTreeWidgetItem* item = jobs[uuid];
-        if (item->isSelected()) {
-            ui->job->setText(log);
-        }
+    if (uuid == shownjob) {
+        ui->job->setText(log);
+        shown = log.size();
     }
 }
 
@@ -547,6 +668,14 @@ MonitorPrivate::statusChanged(Job::Status status)
                 item->setText(Status, "Stopped");
             }
             break;
+            case Job::Timeout: {
+                item->setText(Status, "Timeout");
+            }
+            break;
+            case Job::Skipped: {
+                item->setText(Status, "Skipped");
+            }
+            break;
         }
         updateProgress(item);
         updateMetrics();
@@ -554,6 +683,16 @@ MonitorPrivate::statusChanged(Job::Status status)
     }
 }
 
+void
+MonitorPrivate::duplicateofChanged(QUuid duplicateof)
+{
+    Q_UNUSED(duplicateof);
+    QUuid uuid = qobject_cast<Job*>(sender())->uuid();
+    if (jobs.contains(uuid)) {
+        updateItem(jobs[uuid]);
+    }
+}
+
 void
 MonitorPrivate::selectionChanged()
 {
@@ -563,11 +702,13 @@ MonitorPrivate::selectionChanged()
             QTreeWidgetItem* item = ui->items->selectedItems().first();
             QVariant data = item->data(0, Qt::UserRole);
             QSharedPointer<Job> job = data.value<QSharedPointer<Job>>();
-            ui->job->setText(job->log());
+            showLog(job);
         } else {
+            shownjob = QUuid();
             ui->job->setText("[Multiple selection]");
         }
     } else {
+        shownjob = QUuid();
         ui->job->setText(QString());
     }
     toggleButtons();
@@ -590,7 +731,9 @@ MonitorPrivate::toggleButtons()
         }
         if (job->status() == Job::Completed ||
             job->status() == Job::Stopped ||
-            job->status() == Job::Failed) {
+            job->status() == Job::Failed ||
+            job->status() == Job::Timeout ||
+            job->status() == Job::Skipped) {
             std::function<bool(const QTreeWidgetItem*)> restartItems = [&](const QTreeWidgetItem* parentItem) -> bool {
                 for (int i = 0; i < parentItem->childCount(); ++i) {
                     QTreeWidgetItem* child = parentItem->child(i);
@@ -610,7 +753,7 @@ MonitorPrivate::toggleButtons()
         return false;
     });
     verifyItems([&cleanup](const QTreeWidgetItem* item, const QSharedPointer<Job>& job) -> bool {
-        if (job->status() == Job::Completed) {
+        if (job->status() == Job::Completed || job->status() == Job::Skipped) {
             cleanup = true;
             return true;
         }
@@ -774,7 +917,7 @@ MonitorPrivate::cleanup() {
     std::function<bool(QTreeWidgetItem*)> itemsCompleted = [&](QTreeWidgetItem* item) -> bool {
         QVariant data = item->data(0, Qt::UserRole);
         QSharedPointer<Job> itemJob = data.value<QSharedPointer<Job>>();
-        if (!itemJob || itemJob->status() != Job::Completed) {
+        if (!itemJob || (itemJob->status() != Job::Completed && itemJob->status() != Job::Skipped)) {
             return false;
         }
         for (int i = 0; i < item->childCount(); ++i) {
@@ -785,18 +928,21 @@ MonitorPrivate::cleanup() {
         }
         return true;
     };
+    QList<QUuid> uuids;
     for (int i = ui->items->topLevelItemCount() - 1; i >= 0; --i) {
         QTreeWidgetItem* topLevelItem = ui->items->topLevelItem(i);
         if (itemsCompleted(topLevelItem)) {
-            while (topLevelItem->childCount() > 0) {
-                delete topLevelItem->takeChild(0);
-            }
             if (topLevelItem->isSelected()) {
+                shownjob = QUuid();
                 ui->job->clear();
             }
-            delete ui->items->takeTopLevelItem(i);
+            uuids.append(itemJob(topLevelItem)->uuid());
         }
     }
+    // the queue lets go of the jobs too, items are removed as jobRemoved arrives
+    for (const QUuid& uuid : uuids) {
+        queue->remove(uuid);
+    }
     toggleButtons();
 }
 
@@ -860,10 +1006,61 @@ MonitorPrivate::showMenu(const QPoint& pos)
         connect(remove, &QAction::triggered, this, &MonitorPrivate::remove);
         remove->setEnabled(ui->remove->isEnabled());
         contextMenu.addAction(remove);
+
+        QUuid duplicateof = itemJob(item)->duplicateof();
+        if (!duplicateof.isNull()) {
+            QAction* original = new QAction("Show Original", this);
+            connect(original, &QAction::triggered, this, &MonitorPrivate::showOriginal);
+            original->setEnabled(jobs.contains(duplicateof));
+            contextMenu.addAction(original);
+        }
+        contextMenu.addSeparator();
+
+        QAction* trace = new QAction("Export Trace...", this);
+        connect(trace, &QAction::triggered, this, &MonitorPrivate::exportTrace);
+        contextMenu.addAction(trace);
         contextMenu.exec(ui->items->mapToGlobal(pos));
     }
 }
 
+void
+MonitorPrivate::showOriginal()
+{
+    QList<QTreeWidgetItem*> selected = ui->items->selectedItems();
+    if (selected.isEmpty()) {
+        return;
+    }
+    QTreeWidgetItem* original = jobs.value(itemJob(selected.first())->duplicateof(), nullptr);
+    if (original) {
+        ui->items->clearSelection();
+        ui->items->scrollToItem(original);
+        original->setSelected(true);
+    }
+}
+
+void
+MonitorPrivate::exportTrace()
+{
+    QString filename = QFileDialog::getSaveFileName(
+                        dialog.data(),
+                        tr("Export trace"),
+                        "jobman.trace.json",
+                        tr("Trace files (*.json)")
+    );
+    if (!filename.isEmpty()) {
+        queue->exportTrace(filename);
+    }
+}
+
+void
+MonitorPrivate::showLog(QSharedPointer<Job> job)
+{
+    QString log = queue->log(job); // archived logs are read back from disk
+    shownjob = job->uuid();
+    shown = log.size();
+    ui->job->setText(log);
+}
+
 QTreeWidgetItem*
 MonitorPrivate::findTopLevelItem(QTreeWidgetItem* item)
 {
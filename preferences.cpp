@@ -3,6 +3,7 @@
 // https://github.com/mikaelsundell/jobman
 
 #include "preferences.h"
+#include "commandcache.h"
 
 #include <QFileDialog>
 #include <QPointer>
@@ -92,6 +93,7 @@ PreferencesPrivate::saveSettings()
         }
     }
     settings.setValue("searchpaths", searchpaths);
+    CommandCache::instance()->setSearchpaths(searchpaths);
 }
 
 void
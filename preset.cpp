@@ -84,6 +84,30 @@ PresetPrivate::read()
             if (jsontask.contains("arguments") && jsontask["arguments"].isString()) task.arguments = jsontask["arguments"].toString();
             if (jsontask.contains("startin") && jsontask["startin"].isString()) task.startin = jsontask["startin"].toString();
             if (jsontask.contains("dependson") && jsontask["dependson"].isString()) task.dependson = jsontask["dependson"].toString();
+            if (jsontask.contains("cpus") && jsontask["cpus"].isDouble()) task.cpus = qMax(1, jsontask["cpus"].toInt());
+            if (jsontask.contains("memory") && jsontask["memory"].isDouble()) task.memory = qMax(0, jsontask["memory"].toInt());
+            if (jsontask.contains("pool") && jsontask["pool"].isString()) {
+                QStringList pool = jsontask["pool"].toString().split(':'); // name:limit
+                task.pool = pool.first().trimmed();
+                task.poollimit = (pool.size() > 1) ? qMax(0, pool[1].toInt()) : 0;
+            }
+            if (jsontask.contains("timeout") && jsontask["timeout"].isDouble()) task.timeout = qMax(0, jsontask["timeout"].toInt());
+            if (jsontask.contains("cputimeout") && jsontask["cputimeout"].isDouble()) task.cputimeout = qMax(0, jsontask["cputimeout"].toInt());
+            if (jsontask.contains("cache") && jsontask["cache"].isBool()) task.cache = jsontask["cache"].toBool();
+            if (jsontask.contains("retry") && jsontask["retry"].isObject()) {
+                QJsonObject jsonretry = jsontask["retry"].toObject();
+                task.retry.attempts = qMax(1, jsonretry["attempts"].toInt(task.retry.attempts));
+                task.retry.delay = qMax(0, jsonretry["delay"].toInt(task.retry.delay));
+                task.retry.multiplier = qMax(1.0, jsonretry["multiplier"].toDouble(task.retry.multiplier));
+                task.retry.maxdelay = qMax(task.retry.delay, jsonretry["maxdelay"].toInt(task.retry.maxdelay));
+                task.retry.jitter = qBound(0.0, jsonretry["jitter"].toDouble(task.retry.jitter), 1.0);
+                for (const QJsonValue& exitcode : jsonretry["exitcodes"].toArray()) {
+                    task.retry.exitcodes.append(exitcode.toInt());
+                }
+                for (const QJsonValue& exitsignal : jsonretry["signals"].toArray()) {
+                    task.retry.exitsignals.append(exitsignal.toInt());
+                }
+            }
             if (jsontask.contains("documentation") && jsontask["documentation"].isArray()) {
                 QJsonArray docarray = jsontask["documentation"].toArray();
                 for (int i = 0; i < docarray.size(); ++i) {
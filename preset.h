@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include "job.h"
+
 #include <QList>
 #include <QScopedPointer>
 #include <QString>
@@ -21,6 +23,14 @@ class Task {
         QString startin;
         QString dependson;
         QStringList documentation;
+        int cpus = 1; // cpu slots used while running
+        int memory = 0; // estimated peak memory in megabytes
+        QString pool; // named pool shared by tasks of the same tool
+        int poollimit = 0; // concurrent jobs in pool, 0 for no limit
+        Retry retry;
+        int timeout = 0; // wall clock seconds, 0 for no limit
+        int cputimeout = 0; // cpu seconds, 0 for no limit
+        bool cache = false; // reuse outputs of identical earlier runs
 };
 
 class PresetPrivate;
@@ -1,22 +1,154 @@
-
 // Copyright 2022-present Contributors to the jobman project.
 // SPDX-License-Identifier: BSD-3-Clause
 // https://github.com/mikaelsundell/jobman
 
 #include "process.h"
+#include "commandcache.h"
+#include "spawner.h"
+#include "supervisor.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <spawn.h>
 #include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#if defined(Q_OS_MACOS)
 #include <crt_externs.h>
-#include <sys/stat.h>
+#include <libproc.h>
+#include <mach/mach_time.h>
+#else
+extern char** environ;
+#endif
 
 #include <QDir>
-#include <QProcess>
-#include <QThread>
+#include <QFile>
+#include <QMutex>
+#include <QSet>
+#include <QVector>
+#include <QWaitCondition>
 #include <QDebug>
 
-class ProcessPrivate : public QObject
+class Capture
+{
+    public:
+        Capture();
+        void reset(qint64 capacity, const QString& filename);
+        void append(const char* data, qint64 size);
+        void close();
+        QByteArray tail() const;
+        qint64 total() const;
+        QString filename() const;
+    
+    private:
+        QByteArray ring;
+        qint64 capacity;
+        qint64 position;
+        qint64 bytes;
+        QString spillname;
+        QScopedPointer<QFile> spill;
+};
+
+Capture::Capture()
+: capacity(0)
+, position(0)
+, bytes(0)
+{
+}
+
+void
+Capture::reset(qint64 limit, const QString& filename)
+{
+    close();
+    ring.clear();
+    capacity = limit;
+    position = 0;
+    bytes = 0;
+    spillname = filename;
+}
+
+void
+Capture::append(const char* data, qint64 size)
+{
+    if (capacity <= 0) {
+        ring.append(data, size); // unbounded
+        bytes += size;
+        return;
+    }
+    if (bytes + size > capacity && !spillname.isEmpty() && !spill) {
+        // first overflow, spill what is kept so far and everything after
+        spill.reset(new QFile(spillname));
+        if (spill->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            spill->write(tail());
+        } else {
+            qWarning() << "Could not open output file:" << spillname;
+            spillname.clear();
+            spill.reset();
+        }
+    }
+    if (spill) {
+        spill->write(data, size);
+    }
+    bytes += size;
+    if (size >= capacity) {
+        ring = QByteArray(data + size - capacity, capacity);
+        position = 0;
+        return;
+    }
+    if (ring.size() < capacity) {
+        qint64 space = capacity - ring.size();
+        qint64 count = qMin(space, size);
+        ring.append(data, count);
+        data += count;
+        size -= count;
+    }
+    while (size > 0) { // overwrite the oldest bytes
+        qint64 count = qMin(capacity - position, size);
+        memcpy(ring.data() + position, data, count);
+        position = (position + count) % capacity;
+        data += count;
+        size -= count;
+    }
+}
+
+void
+Capture::close()
+{
+    if (spill) {
+        spill->close();
+        spill.reset();
+    }
+}
+
+QByteArray
+Capture::tail() const
+{
+    if (capacity <= 0 || bytes <= capacity) {
+        return ring;
+    }
+    QByteArray ordered = (position == 0) ? ring : ring.mid(position) + ring.left(position);
+    int skip = 0;
+    while (skip < ordered.size() && (static_cast<uchar>(ordered[skip]) & 0xC0) == 0x80) {
+        skip++; // don't start in the middle of a utf-8 sequence
+    }
+    return ordered.mid(skip);
+}
+
+qint64
+Capture::total() const
+{
+    return bytes;
+}
+
+QString
+Capture::filename() const
+{
+    return (bytes > capacity && capacity > 0) ? spillname : QString();
+}
+
+class ProcessPrivate : public QObject, public Supervisor::Client
 {
     Q_OBJECT
     public:
@@ -26,29 +158,35 @@ class ProcessPrivate : public QObject
         void run(const QString& command, const QStringList& arguments, const QString& startin);
         bool wait();
         void kill();
-        void kill(int pid);
+        void readyRead(Supervisor::Channel channel, const char* data, qint64 size) override;
+        void finished(int status) override;
     public:
         QString mapCommand(const QString& command);
+        QString captured(const Capture& capture) const;
         pid_t pid;
         int exitCode;
-        QString outputBuffer;
-        QString errorBuffer;
+        qint64 capacity;
+        QString outputFile;
+        QString errorFile;
+        Capture output;
+        Capture error;
         bool running;
-        int outputpipe[2];
-        int errorpipe[2];
+        mutable QMutex mutex;
+        QWaitCondition condition;
+        Process* process;
 };
 
 ProcessPrivate::ProcessPrivate()
 : pid(-1)
 , exitCode(-1)
+, capacity(0)
 , running(false)
+, process(nullptr)
 {
 }
 
 ProcessPrivate::~ProcessPrivate()
 {
-    if (outputpipe[0] != -1) close(outputpipe[0]);
-    if (errorpipe[0] != -1) close(errorpipe[0]);
 }
 
 void
@@ -59,79 +197,144 @@ ProcessPrivate::init()
 void
 ProcessPrivate::run(const QString& command, const QStringList& arguments, const QString& startin)
 {
-    running = false;
-    outputBuffer.clear();
-    errorBuffer.clear();
+    {
+        QMutexLocker locker(&mutex);
+        running = false;
+        exitCode = -1;
+        output.reset(capacity, outputFile);
+        error.reset(capacity, errorFile);
+    }
     QString absolutepath = mapCommand(command);
     QList<char *> argv;
     QByteArray commandbytes = absolutepath.toLocal8Bit();
     argv.push_back(commandbytes.data());
     std::vector<QByteArray> argbytes;
+    argbytes.reserve(arguments.size());
     for (const QString &arg : arguments) {
         argbytes.push_back(arg.toLocal8Bit());
         argv.push_back(argbytes.back().data());
     }
     argv.push_back(nullptr);
 
-    posix_spawn_file_actions_t actions;
-    posix_spawn_file_actions_init(&actions);
-
+    int outputpipe[2];
+    int errorpipe[2];
     // Check if pipes are created successfully
-    if (pipe(outputpipe) == -1 || pipe(errorpipe) == -1) {
+    if (pipe(outputpipe) == -1) {
         qDebug() << "Error creating pipes";
         return;  // Handle pipe creation failure
     }
-
-    posix_spawn_file_actions_adddup2(&actions, outputpipe[1], STDOUT_FILENO);
-    posix_spawn_file_actions_adddup2(&actions, errorpipe[1], STDERR_FILENO);
-    posix_spawn_file_actions_addclose(&actions, outputpipe[0]);
-    posix_spawn_file_actions_addclose(&actions, errorpipe[0]);
-
-    if (!startin.isEmpty()) {
-        chdir(startin.toLocal8Bit().data());
+    if (pipe(errorpipe) == -1) {
+        qDebug() << "Error creating pipes";
+        close(outputpipe[0]);
+        close(outputpipe[1]);
+        return;
+    }
+    // keep pipes of concurrent jobs out of each other's children
+    for (int fd : { outputpipe[0], outputpipe[1], errorpipe[0], errorpipe[1] }) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
     }
 
-    char** environ = *_NSGetEnviron();
-    int status = posix_spawn(&pid, commandbytes.data(), &actions, nullptr, argv.data(), environ);
-    posix_spawn_file_actions_destroy(&actions);
+    pid_t childpid = -1;
+    int status = 0;
+    bool external = false;
+    QByteArray startinbytes = startin.toLocal8Bit();
+    Spawner* spawner = Spawner::instance();
+    if (spawner->isEnabled() && spawner->isRunning()) {
+        // the small helper forks cheaply regardless of our own footprint
+        childpid = spawner->spawn(commandbytes, QList<QByteArray>(argbytes.begin(), argbytes.end()), startinbytes, outputpipe[1], errorpipe[1], &status);
+        external = (childpid > 0);
+        if (!external && status == 0) {
+            status = ECHILD;
+        }
+    }
+    if (!external && (status == 0 || status == ECONNREFUSED || status == ECONNRESET)) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, outputpipe[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, errorpipe[1], STDERR_FILENO);
+        if (!startin.isEmpty()) {
+            // changes directory in the child only, concurrent spawns don't race on our cwd
+            posix_spawn_file_actions_addchdir_np(&actions, startinbytes.constData());
+        }
+#if defined(Q_OS_MACOS)
+        char** environment = *_NSGetEnviron();
+#else
+        char** environment = environ;
+#endif
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETPGROUP); // own process group, signals reach the whole tool
+        posix_spawnattr_setpgroup(&attributes, 0);
+        status = posix_spawn(&childpid, commandbytes.data(), &actions, &attributes, argv.data(), environment);
+        posix_spawnattr_destroy(&attributes);
+        posix_spawn_file_actions_destroy(&actions);
+    }
 
     // Close write ends of pipes immediately after spawning the process
     close(outputpipe[1]);
     close(errorpipe[1]);
 
     if (status == 0) {
-        running = true;
+        {
+            QMutexLocker locker(&mutex);
+            pid = childpid;
+            running = true;
+        }
+        // the supervisor drains both pipes and reaps the child asynchronously,
+        // children of the helper are reaped there and reported back
+        Supervisor::instance()->watch(childpid, outputpipe[0], errorpipe[0], this, external);
     } else {
+        close(outputpipe[0]);
+        close(errorpipe[0]);
         exitCode = -1;
-        qDebug() << "Process failed to start";
+        qDebug() << "Process failed to start:" << strerror(status);
     }
 }
 
 bool
 ProcessPrivate::wait()
 {
-    if (running) {
-        int status;
-        waitpid(pid, &status, 0);
-        running = false;
-        char buffer[1024];
-        ssize_t bytesread;
-        if (outputpipe[0] != -1) {
-            while ((bytesread = read(outputpipe[0], buffer, sizeof(buffer) - 1)) > 0) {
-                buffer[bytesread] = '\0';
-                outputBuffer.append(buffer);
-            }
-            close(outputpipe[0]);
-            outputpipe[0] = -1;
-        }
-        if (errorpipe[0] != -1) {
-            while ((bytesread = read(errorpipe[0], buffer, sizeof(buffer) - 1)) > 0) {
-                buffer[bytesread] = '\0';
-                errorBuffer.append(buffer);
-            }
-            close(errorpipe[0]);
-            errorpipe[0] = -1;
-        }
+    QMutexLocker locker(&mutex);
+    if (pid <= 0) {
+        return false;
+    }
+    while (running) {
+        condition.wait(&mutex);
+    }
+    return exitCode == 0;
+}
+
+void
+ProcessPrivate::kill()
+{
+    bool alive;
+    {
+        QMutexLocker locker(&mutex);
+        alive = running;
+    }
+    if (alive) {
+        Process::kill(pid);
+        wait();
+    }
+}
+
+void
+ProcessPrivate::readyRead(Supervisor::Channel channel, const char* data, qint64 size)
+{
+    QMutexLocker locker(&mutex);
+    if (channel == Supervisor::Output) {
+        output.append(data, size);
+    } else {
+        error.append(data, size);
+    }
+}
+
+void
+ProcessPrivate::finished(int status)
+{
+    int code;
+    {
+        QMutexLocker locker(&mutex);
         if (WIFEXITED(status)) {
             exitCode = WEXITSTATUS(status);
         } else if (WIFSIGNALED(status)) {
@@ -139,33 +342,40 @@ ProcessPrivate::wait()
         } else {
             exitCode = -1;
         }
-        return exitCode == 0;
+        running = false;
+        code = exitCode;
+        output.close();
+        error.close();
+        condition.wakeAll();
+    }
+    if (process) {
+        process->finished(code);
     }
-    return false;
 }
 
-void
-ProcessPrivate::kill()
+QString
+ProcessPrivate::mapCommand(const QString& command)
 {
-    if (running) {
-        ::kill(pid, SIGKILL);
-        wait();
+    if (QDir::isAbsolutePath(command)) {
+        return command;
     }
+    QString resolved = CommandCache::instance()->resolve(command);
+    return resolved.isEmpty() ? command : resolved;
 }
 
 QString
-ProcessPrivate::mapCommand(const QString& command)
+ProcessPrivate::captured(const Capture& capture) const
 {
-    QString pathenv = QString::fromLocal8Bit(getenv("PATH"));
-    QStringList paths = pathenv.split(':');
-    for (const QString& path : paths) {
-        QString fullPath = path + "/" + command;
-        struct stat buffer;
-        if (stat(fullPath.toLocal8Bit().data(), &buffer) == 0 && (buffer.st_mode & S_IXUSR)) {
-            return fullPath;
+    QString text = QString::fromUtf8(capture.tail());
+    qint64 dropped = capture.total() - capture.tail().size();
+    if (dropped > 0) {
+        QString notice = QString("[%1 earlier bytes not kept in memory").arg(dropped);
+        if (!capture.filename().isEmpty()) {
+            notice += QString(", full output in: %1").arg(capture.filename());
         }
+        text.prepend(notice + "]\n");
     }
-    return command;
+    return text;
 }
 
 #include "process.moc"
@@ -173,10 +383,12 @@ ProcessPrivate::mapCommand(const QString& command)
 Process::Process()
 : p(new ProcessPrivate())
 {
+    p->process = this;
 }
 
 Process::~Process()
 {
+    Supervisor::instance()->unwatch(p.data()); // no callbacks after this point
 }
 
 void
@@ -194,9 +406,7 @@ Process::wait()
 bool
 Process::exists(const QString& command)
 {
-    Process process;
-    process.run("which", QStringList() << command, "");
-    return process.wait();
+    return !CommandCache::instance()->resolve(command).isEmpty();
 }
 
 void
@@ -208,35 +418,136 @@ Process::kill()
 int
 Process::pid() const
 {
+    QMutexLocker locker(&p->mutex);
     return p->pid;
 }
 
+void
+Process::setCapture(qint64 capacity, const QString& outputFile, const QString& errorFile)
+{
+    QMutexLocker locker(&p->mutex);
+    p->capacity = capacity;
+    p->outputFile = outputFile;
+    p->errorFile = errorFile;
+}
+
 QString
 Process::standardOutput() const
 {
-    return p->outputBuffer;
+    QMutexLocker locker(&p->mutex);
+    return p->captured(p->output);
 }
 
 QString
 Process::standardError() const
 {
-    return p->errorBuffer;
+    QMutexLocker locker(&p->mutex);
+    return p->captured(p->error);
 }
 
 int
 Process::exitCode() const
 {
+    QMutexLocker locker(&p->mutex);
     return p->exitCode;
 }
 
 Process::Status
 Process::exitStatus() const
 {
-    return (p->exitCode == 0) ? Process::Normal : Process::Crash;
+    return (exitCode() == 0) ? Process::Normal : Process::Crash;
 }
 
 void
 Process::kill(int pid)
 {
-    ::kill(pid, SIGKILL);
+    if (::kill(-pid, SIGKILL) == -1) { // process group, falls back to the process
+        ::kill(pid, SIGKILL);
+    }
+}
+
+void
+Process::terminate(int pid)
+{
+    if (::kill(-pid, SIGTERM) == -1) {
+        ::kill(pid, SIGTERM);
+    }
+}
+
+QHash<int, qint64>
+Process::cpuTimes(const QList<int>& pids)
+{
+    // ms of cpu time for each process group, work done in children counts too.
+    // members that exited and were reaped count through their parent's child
+    // times. groups that are gone are left out
+    QHash<int, qint64> times;
+#if defined(Q_OS_MACOS)
+    static mach_timebase_info_data_t timebase = []() {
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        return timebase;
+    }();
+    for (int pid : pids) {
+        QVector<pid_t> members(256);
+        int count = proc_listpgrppids(pid, members.data(), members.size() * sizeof(pid_t));
+        if (count > members.size()) {
+            members.resize(count);
+            count = proc_listpgrppids(pid, members.data(), members.size() * sizeof(pid_t));
+        }
+        if (count <= 0) {
+            members = { pid }; // not a group leader
+            count = 1;
+        }
+        quint64 ticks = 0; // mach time units
+        bool found = false;
+        for (int i = 0; i < qMin(count, static_cast<int>(members.size())); ++i) {
+            struct rusage_info_v2 info;
+            if (proc_pid_rusage(members[i], RUSAGE_INFO_V2, reinterpret_cast<rusage_info_t*>(&info)) == 0) {
+                ticks += info.ri_user_time + info.ri_system_time + info.ri_child_user_time + info.ri_child_system_time;
+                found = true;
+            }
+        }
+        if (found) {
+            times.insert(pid, static_cast<qint64>(ticks * timebase.numer / timebase.denom / 1000000));
+        }
+    }
+#else
+    // linux has no list of a group's members, /proc is scanned once for all groups
+    QSet<int> groups(pids.begin(), pids.end());
+    if (groups.isEmpty()) {
+        return times;
+    }
+    QHash<int, qint64> ticks;
+    QDir proc("/proc");
+    for (const QString& entry : proc.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        bool number = false;
+        int member = entry.toInt(&number);
+        if (!number) {
+            continue;
+        }
+        QFile file(QString("/proc/%1/stat").arg(member));
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue; // exited while listing
+        }
+        QByteArray stat = file.readAll();
+        // fields after the command name, which may contain spaces
+        QList<QByteArray> fields = stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+        if (fields.size() < 15) {
+            continue;
+        }
+        int group = fields[2].toInt();
+        if (!groups.contains(group)) {
+            if (!groups.contains(member)) {
+                continue;
+            }
+            group = member; // a leader that left its group
+        }
+        // utime, stime and the reaped children's cutime and cstime
+        ticks[group] += fields[11].toLongLong() + fields[12].toLongLong() + fields[13].toLongLong() + fields[14].toLongLong();
+    }
+    for (auto it = ticks.constBegin(); it != ticks.constEnd(); ++it) {
+        times.insert(it.key(), it.value() * 1000 / sysconf(_SC_CLK_TCK));
+    }
+#endif
+    return times;
 }
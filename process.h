@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <QHash>
+#include <QList>
 #include <QObject>
 
 class ProcessPrivate;
@@ -25,6 +27,7 @@ class Process : public QObject {
         bool exists(const QString& command);
         void kill();
         int pid() const;
+        void setCapture(qint64 capacity, const QString& outputFile = QString(), const QString& errorFile = QString());
         QString standardOutput() const;
         QString standardError() const;
         int exitCode() const;
@@ -32,6 +35,11 @@ class Process : public QObject {
     
     public:
         static void kill(int pid);
+        static void terminate(int pid);
+        static QHash<int, qint64> cpuTimes(const QList<int>& pids);
+    
+    Q_SIGNALS:
+        void finished(int exitCode);
     
     private:
         QScopedPointer<ProcessPrivate> p;
@@ -3,16 +3,42 @@
 // https://github.com/mikaelsundell/jobman
 
 #include "queue.h"
+#include "commandcache.h"
+#include "fairqueue.h"
+#include "jobgraph.h"
+#include "journal.h"
+#include "logstore.h"
+#include "metrics.h"
 #include "process.h"
-#include "mac.h"
+#include "resultcache.h"
+#include "trace.h"
+#include "waitqueue.h"
 
 #include <QObject>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMap>
+#include <QMutex>
 #include <QPointer>
+#include <QSet>
+#include <QStandardPaths>
+#include <QThread>
 #include <QThreadPool>
 #include <QtConcurrent>
+#include <QTimer>
+#include <QRandomGenerator>
 #include <QCoreApplication>
 #include <QDebug>
 
+#include <cmath>
+#include <unistd.h>
+#if defined(Q_OS_MACOS)
+#include <sys/sysctl.h>
+#endif
+
 #define THREAD_FUNC_SAFE() static QMutex mutex; QMutexLocker locker(&mutex);
 #define THREAD_OBJECT_SAFE(obj) static QMutex obj##_mutex; QMutexLocker locker(&obj##_mutex);
 
@@ -24,86 +50,383 @@ class QueuePrivate : public QObject
     public:
         QueuePrivate();
         void init();
-        void update();
         QUuid submit(QSharedPointer<Job> job);
+        void submit(const QList<QSharedPointer<Job>>& jobs);
+        void restore();
+        void connectJob(QSharedPointer<Job> job);
+        void journalChanged(bool first);
+        void flushJournal();
         void start(const QUuid& uuid);
         void stop(const QUuid& uuid);
         void restart(const QUuid& uuid);
         void remove(const QUuid& uuid);
+        void discard(QSharedPointer<Job> job);
+        void enqueue(JobGraph::Node* node);
+        JobGraph::Node* attach(QSharedPointer<Job> job);
+        void detach(QSharedPointer<Job> job);
+        void forget(QSharedPointer<Job> job);
+        void mirror(const QUuid& uuid);
+        QUuid original(const QUuid& uuid) const;
+        static QByteArray fingerprint(QSharedPointer<Job> job);
+        qint64 key(const JobGraph::Node* node) const;
+        void rekey();
+        void unqueue(QSharedPointer<Job> job);
+        void park(QSharedPointer<Job> job);
+        void unpark(const QString& name);
+        bool saturated(const QString& name) const;
+        void priorityChanged(const QUuid& uuid, int priority);
+        void dispatchJobs(const QList<QSharedPointer<Job>>& jobs);
         void processJob(QSharedPointer<Job> job);
+        void checkJob(QSharedPointer<Job> job);
+        void skipJob(QSharedPointer<Job> job);
+        void finishJob(QSharedPointer<Job> job);
+        void completeJob(QSharedPointer<Job> job);
+        void spawnJob(QSharedPointer<Job> job, const QString& command);
+        void hashJob(QSharedPointer<Job> job, const QString& command);
+        bool restoreJob(QSharedPointer<Job> job, const QString& key);
+        void cacheJob(QSharedPointer<Job> job);
+        void flushCache();
+        void retryJob(QSharedPointer<Job> job, int delay);
+        int retryDelay(QSharedPointer<Job> job, int exitCode) const;
+        void release(QSharedPointer<Job> job);
+        void watchJob(QSharedPointer<Job> job, int pid);
+        void timeoutJob(const QUuid& uuid, int pid, const QString& reason);
+        void checkCpuTime();
+        void retire(const QUuid& uuid);
+        void archiveLogs();
+        void archiveLog(QSharedPointer<Job> job);
+        QString logText(const QUuid& uuid, const QList<JobLog::Segment>& segments) const;
+        void retain(int jobs, int hours);
+        void evictJobs();
+        static bool finished(Job::Status status);
+        void exportTo(const QString& target, int interval);
+        void exportMetrics();
+        static Metrics::Labels labels(QSharedPointer<Job> job);
+        QString captureFile(const QUuid& uuid, const QString& channel) const;
+        int physicalMemory() const;
+        static bool upToDate(QSharedPointer<Job> job);
         QSharedPointer<Job> findNextJob();
         void processNextJobs();
-        void processRemovedJobs();
         void processDependentJobs(const QUuid& dependsonUuid);
         void failDependentJobs(const QUuid& dependsonId);
-        void failCompletedJobs(const QUuid& uuid, const QUuid& dependsonId);
+        void failOrphanedJobs(const QList<QUuid>& uuids);
+        void cancelJob(JobGraph::Node* node);
+        void failCompletedJobs(const QUuid& uuid);
 
     public Q_SLOTS:
         void statusChanged(const QUuid& uuid, Job::Status status);
     
-    Q_SIGNALS:
-        void notifyStatusChanged(const QUuid& uuid, Job::Status status);
-    
     public:
+        enum {
+            Capacity = 64 * 1024, // bytes of output kept in memory per channel
+            Lookahead = 32, // waiting jobs considered for backfill per dispatch
+            Compaction = 100000, // journal records before compacting into a snapshot
+            Grace = 5000, // ms between terminate and kill on timeout
+            Watchdog = 1000, // ms between cpu time checks
+            Archive = 10000, // ms a finished job keeps its whole log in memory
+            Index = 5000, // ms the result cache index may lag behind its use
+            Retention = 60000, // ms between eviction of finished jobs
+            Minute = 60000 // aging rate is in priority points per minute
+        };
+        struct Reservation {
+            int cpus;
+            int memory;
+        };
+        struct Pool {
+            int limit = 0; // no limit
+            int used = 0;
+            WaitQueue parked; // waiting while the pool is saturated
+        };
+        struct Cached {
+            QString key;
+            QDateTime started;
+        };
+        Reservation reserve(QSharedPointer<Job> job) const;
         int threads;
+        int memory;
+        int aging;
+        bool incremental;
+        int usedcpus;
+        int usedmemory;
+        QHash<QUuid, Reservation> reservations;
+        QHash<QString, Pool> pools;
+        QString capturedir;
         QMutex mutex;
         QThread thread;
-        QThreadPool threadPool;
-        QMap<QUuid, QSharedPointer<Job>> allJobs;
-        QList<QSharedPointer<Job>> waitingJobs;
-        QSet<QUuid> completedJobs;
-        QMap<QUuid, QList<QSharedPointer<Job>>> dependentJobs;
-        QMap<QUuid, QSharedPointer<Job>> removedJobs;
+        QHash<QUuid, QSharedPointer<Process>> processes;
+        QHash<QUuid, QSharedPointer<Job>> cpulimited;
+        QHash<QUuid, QString> timeouts;
+        QHash<QUuid, Cached> cached; // running jobs whose outputs are stored on completion
+        QSet<QUuid> forced; // restarted by hand, run even if up to date
+        QHash<QByteArray, QUuid> fingerprints; // jobs queued, running or done by what they run
+        QHash<QUuid, QList<QUuid>> duplicates; // original to the submissions that follow it
+        QPointer<QTimer> watchdog;
+        QPointer<QTimer> exporter;
+        QString metricsfile;
+        Metrics metrics;
+        QHash<QUuid, qint64> spawned; // queue clock ms when the process started
+        Trace trace;
+        LogStore logs;
+        QHash<QUuid, qint64> retired; // finished jobs to archive the log of, by queue clock ms
+        QHash<QUuid, qint64> finishedat; // ms since epoch a job last finished, for retention
+        QMultiMap<qint64, QUuid> finishorder; // the same, oldest first, while retention is on
+        bool retaining;
+        QMutex retiredmutex;
+        QPointer<QTimer> archiver;
+        QPointer<QTimer> indexer;
+        QFuture<void> archiving;
+        int retainjobs; // finished jobs kept, 0 keeps all
+        int retainhours; // hours a finished job is kept, 0 keeps it
+        QPointer<QTimer> evictor;
+        QThreadPool hashpool; // input hashing and incremental stats, off the queue thread
+        Queue::Executor* executor; // runs jobs in place of a process when set
+        JobGraph graph;
+        Journal journal;
+        ResultCache cache;
+        FairQueue waitingJobs; // batches at the same effective priority share fairly
+        quint64 sequence;
+        QElapsedTimer clock;
         QPointer<Queue> queue;
 };
 
 QueuePrivate::QueuePrivate()
 : threads(1)
+, memory(0)
+, aging(1)
+, incremental(false)
+, usedcpus(0)
+, usedmemory(0)
+, sequence(0)
+, retaining(false)
+, retainjobs(0)
+, retainhours(0)
+, executor(nullptr)
+, waitingJobs(Minute)
 {
-    threadPool.setMaxThreadCount(threads);
-    threadPool.setExpiryTimeout(-1);
 }
 
 void
 QueuePrivate::init()
 {
-    // treads
-    QThreadPool::globalInstance()->setThreadPriority(QThread::LowPriority); // scheduled less often than ui thread
-    // connect
-    connect(this, &QueuePrivate::notifyStatusChanged, this, &QueuePrivate::statusChanged, Qt::QueuedConnection);
-    update();
+    capturedir = QDir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)).filePath("Output");
+    QDir().mkpath(capturedir);
+    memory = physicalMemory();
+    clock.start();
+    journal.open(QDir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)).filePath("Journal"));
+    cache.open(QDir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)).filePath("Cache"));
+    logs.open(QDir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)).filePath("Logs"));
+    // seconds, from a millisecond to an hour
+    QList<double> seconds = { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60, 300, 900, 3600 };
+    metrics.counter("jobman_jobs_submitted_total", "Jobs submitted to the queue.");
+    metrics.counter("jobman_jobs_dispatched_total", "Jobs dispatched to run, retries included.");
+    metrics.counter("jobman_jobs_completed_total", "Jobs completed, skipped or restored from cache.");
+    metrics.counter("jobman_jobs_failed_total", "Jobs failed or timed out.");
+    metrics.gauge("jobman_queue_depth", "Jobs ready to run and waiting for a slot or pool.");
+    metrics.gauge("jobman_jobs_running", "Jobs with a running process.");
+    metrics.histogram("jobman_queue_wait_seconds", "Time from ready to dispatch.", seconds);
+    metrics.histogram("jobman_spawn_latency_seconds", "Time to start the process.", seconds);
+    metrics.histogram("jobman_runtime_seconds", "Time from process start to exit.", seconds);
+}
+
+QUuid
+QueuePrivate::submit(QSharedPointer<Job> job)
+{
+    submit(QList<QSharedPointer<Job>>() << job);
+    return job->uuid();
 }
 
 void
-QueuePrivate::update()
+QueuePrivate::submit(const QList<QSharedPointer<Job>>& jobs)
 {
-    threadPool.setMaxThreadCount(threads);
+    if (jobs.isEmpty()) {
+        return;
+    }
+    QSet<QUuid> attached;
+    QList<QUuid> orphaned;
+    {
+        QMutexLocker locker(&mutex);
+        waitingJobs.reserve(waitingJobs.size() + jobs.size());
+        for (const QSharedPointer<Job>& job : jobs) {
+            QUuid uuid = job->uuid();
+            QString log = QString("Uuid:\n"
+                                  "%1\n\n"
+                                  "Command:\n"
+                                  "%2 %3\n")
+                                  .arg(uuid.toString())
+                                  .arg(job->command())
+                                  .arg(job->arguments().join(' '));
+            job->setLog(log);
+            metrics.increment("jobman_jobs_submitted_total", labels(job));
+            trace.describe(uuid, job->name(), job->filename(), job->dependson());
+            if (attach(job)) {
+                attached.insert(job->duplicateof());
+            } else {
+                JobGraph::Node* node = graph.insert(job, job->dependson(), sequence++);
+                if (node->state == JobGraph::Ready) {
+                    enqueue(node);
+                } else if (graph.isFailed(node->dependson)) {
+                    orphaned.append(uuid);
+                }
+                fingerprints.insert(fingerprint(job), uuid);
+            }
+            journalChanged(journal.submitted(job));
+            connectJob(job);
+        }
+    }
+    if (!attached.isEmpty()) {
+        // duplicates of finished jobs finish from the queue thread, after the submit returns
+        QMetaObject::invokeMethod(this, [this, attached]() {
+            {
+                QMutexLocker locker(&mutex);
+                for (const QUuid& uuid : attached) {
+                    mirror(uuid);
+                }
+            }
+            processNextJobs();
+        }, Qt::QueuedConnection);
+    }
+    failOrphanedJobs(orphaned);
+    processNextJobs();
+    queue->jobsSubmitted(jobs);
 }
 
-QUuid
-QueuePrivate::submit(QSharedPointer<Job> job)
+void
+QueuePrivate::restore()
 {
+    // completed jobs stay done, jobs that were running when we went down run again.
+    // tombstones of evicted jobs come first so their dependents resolve
+    Journal::Tombstones tombstones;
+    QList<QSharedPointer<Job>> jobs = journal.replay(&tombstones);
     {
         QMutexLocker locker(&mutex);
-        QString log = QString("Uuid:\n"
-                              "%1\n\n"
-                              "Command:\n"
-                              "%2 %3\n")
-                              .arg(job->uuid().toString())
-                              .arg(job->command())
-                              .arg(job->arguments().join(' '));
-        job->setLog(log);
-        allJobs.insert(job->uuid(), job);
-        if (job->dependson().isNull() || completedJobs.contains(job->dependson())) {
-            waitingJobs.append(job);
-        } else {
-            dependentJobs[job->dependson()].append(job);
+        for (const auto& tombstone : tombstones) {
+            graph.remember(tombstone.first, tombstone.second);
+        }
+    }
+    QSet<QUuid> held;
+    for (const QSharedPointer<Job>& job : jobs) {
+        held.insert(job->uuid());
+    }
+    logs.retain(held); // logs of jobs removed before the restart are dropped
+    if (jobs.isEmpty()) {
+        return;
+    }
+    QSet<QUuid> attached;
+    QList<QUuid> orphaned;
+    {
+        QMutexLocker locker(&mutex);
+        for (const QSharedPointer<Job>& job : jobs) {
+            if (job->status() == Job::Running) {
+                job->setStatus(Job::Waiting);
+            }
+            QString log = QString("Uuid:\n"
+                                  "%1\n\n"
+                                  "Command:\n"
+                                  "%2 %3\n\n"
+                                  "Status:\n"
+                                  "Restored from journal\n")
+                                  .arg(job->uuid().toString())
+                                  .arg(job->command())
+                                  .arg(job->arguments().join(' '));
+            job->setLog(log);
+            if (logs.contains(job->uuid())) {
+                // archived before the restart, the Monitor reads it back on demand
+                qint64 revision = 0;
+                job->logSegments(&revision);
+                job->archiveLog(revision);
+            }
+            trace.describe(job->uuid(), job->name(), job->filename(), job->dependson());
+            if (job->status() == Job::Waiting && attach(job)) {
+                attached.insert(job->duplicateof());
+                connectJob(job);
+                continue;
+            }
+            JobGraph::Node* node = graph.insert(job, job->dependson(), sequence++);
+            if (job->status() != Job::Failed && job->status() != Job::Timeout && !fingerprints.contains(fingerprint(job))) {
+                fingerprints.insert(fingerprint(job), job->uuid());
+            }
+            switch (job->status()) {
+                case Job::Completed:
+                case Job::Skipped:
+                case Job::Dependency: {
+                    node->state = JobGraph::Done;
+                    retire(job->uuid()); // retained from when it was restored
+                }
+                break;
+                case Job::Failed:
+                case Job::Timeout: {
+                    node->state = JobGraph::Failed;
+                    retire(job->uuid());
+                }
+                break;
+                case Job::Stopped: {
+                    node->state = JobGraph::Stopped;
+                }
+                break;
+                default: {
+                    if (node->state == JobGraph::Ready) {
+                        enqueue(node);
+                    } else if (graph.isFailed(node->dependson)) {
+                        orphaned.append(job->uuid());
+                    }
+                }
+                break;
+            }
+            connectJob(job);
+        }
+        for (const QUuid& uuid : attached) {
+            mirror(uuid);
         }
     }
+    failOrphanedJobs(orphaned);
     processNextJobs();
-    processRemovedJobs();
-    queue->jobSubmitted(job);
-    return job->uuid();
+    queue->jobsSubmitted(jobs);
+}
+
+void
+QueuePrivate::connectJob(QSharedPointer<Job> job)
+{
+    QUuid uuid = job->uuid();
+    connect(job.data(), &Job::priorityChanged, this, [this, uuid](int priority) {
+        priorityChanged(uuid, priority);
+    }, Qt::QueuedConnection);
+    // journaled from the emitting thread so no transition is missed
+    connect(job.data(), &Job::statusChanged, this, [this, uuid](Job::Status status) {
+        journalChanged(journal.statusChanged(uuid, status));
+        if (status != Job::Waiting && status != Job::Running) {
+            retire(uuid);
+        } else if (status == Job::Waiting) { // started again, no longer finished
+            QMutexLocker locker(&retiredmutex);
+            finishedat.remove(uuid);
+        }
+    }, Qt::DirectConnection);
+}
+
+void
+QueuePrivate::journalChanged(bool first)
+{
+    if (first) { // group everything recorded until the queue thread gets to it
+        QMetaObject::invokeMethod(this, [this]() {
+            flushJournal();
+        }, Qt::QueuedConnection);
+    }
+}
+
+void
+QueuePrivate::flushJournal()
+{
+    journal.flush();
+    QList<QSharedPointer<Job>> jobs;
+    Journal::Tombstones tombstones;
+    {
+        QMutexLocker locker(&mutex);
+        if (journal.records() < Compaction || journal.records() < 4 * graph.size()) {
+            return;
+        }
+        jobs = graph.jobs();
+        tombstones = graph.tombstones();
+    }
+    journal.compact(jobs, tombstones);
 }
 
 void
@@ -112,10 +435,16 @@ QueuePrivate::start(const QUuid& uuid)
     bool start = false;
     {
         QMutexLocker locker(&mutex);
-        QSharedPointer<Job> job = allJobs[uuid];
-        if (job->status() == Job::Stopped) {
+        JobGraph::Node* node = graph.node(original(uuid));
+        if (node && node->job->status() == Job::Stopped) {
+            QSharedPointer<Job> job = node->job;
             job->setStatus(Job::Waiting);
-            waitingJobs.append(job);
+            job->setAttempt(0);
+            if (graph.isReady(node->dependson)) {
+                enqueue(node);
+            } else {
+                node->state = JobGraph::Blocked;
+            }
             QString log = QString("Uuid:\n"
                                   "%1\n\n"
                                   "Command:\n"
@@ -124,6 +453,7 @@ QueuePrivate::start(const QUuid& uuid)
                                   .arg(job->command())
                                   .arg(job->arguments().join(' '));
             job->setLog(log);
+            mirror(job->uuid());
             start = true;
         }
     }
@@ -137,9 +467,11 @@ QueuePrivate::stop(const QUuid& uuid)
 {
     {
         QMutexLocker locker(&mutex);
-        QSharedPointer<Job> job = allJobs[uuid];
-        if (job->status() == Job::Running) {
+        JobGraph::Node* node = graph.node(original(uuid)); // a duplicate stops the work it follows
+        if (node && node->job->status() == Job::Running) {
+            QSharedPointer<Job> job = node->job;
             job->setStatus(Job::Stopped);
+            node->state = JobGraph::Stopped;
             int pid = job->pid();
             if (pid > 0) {
                 Process::kill(job->pid());
@@ -152,44 +484,56 @@ QueuePrivate::stop(const QUuid& uuid)
                                   .arg(job->command())
                                   .arg(job->arguments().join(' '));
             job->setLog(log);
+            mirror(job->uuid());
         }
     }
     processNextJobs();
 }
 
 void
-QueuePrivate::restart(const QUuid& uuid)
+QueuePrivate::restart(const QUuid& requested)
 {
     {
         QMutexLocker locker(&mutex);
-        std::function<void(const QUuid&)> restartJob = [&](const QUuid& jobUuid) {
-            QSharedPointer<Job> job = allJobs[jobUuid];
-            if (job->status() != Job::Running) {
-                job->setStatus(Job::Waiting);
-                if (job->dependson().isNull()) {
-                    waitingJobs.append(job);
-                } else {
-                    if (!dependentJobs[job->dependson()].contains(job)) {
-                        dependentJobs[job->dependson()].append(job);
-                    }
-                }
-                QString log = QString("Uuid:\n"
-                                      "%1\n\n"
-                                      "Command:\n"
-                                      "%2 %3\n")
-                                      .arg(job->uuid().toString())
-                                      .arg(job->command())
-                                      .arg(job->arguments().join(' '));
-                job->setLog(log);
-                for (QSharedPointer<Job>& dependentJob : allJobs) {
-                    if (dependentJob->dependson() == jobUuid) {
-                        restartJob(dependentJob->uuid());
-                    }
-                }
-                
+        QUuid uuid = original(requested); // a duplicate restarts the job it follows
+        if (!graph.contains(uuid)) {
+            return;
+        }
+        QList<QUuid> uuids = graph.descendants(uuid);
+        uuids.prepend(uuid);
+        QSet<QUuid> skipped;
+        for (const QUuid& jobUuid : uuids) {
+            JobGraph::Node* node = graph.node(jobUuid);
+            QSharedPointer<Job> job = node->job;
+            if (skipped.contains(node->dependson) || job->status() == Job::Running) {
+                skipped.insert(jobUuid); // running jobs keep their subtree
+                continue;
             }
-        };
-        restartJob(uuid);
+            if (!job->duplicateof().isNull()) {
+                continue; // follows its original, not its parent
+            }
+            job->setStatus(Job::Waiting);
+            job->setAttempt(0);
+            forced.insert(jobUuid);
+            if (!fingerprints.contains(fingerprint(job))) {
+                fingerprints.insert(fingerprint(job), jobUuid);
+            }
+            unqueue(job);
+            if (graph.isReady(node->dependson)) { // parents were reset first, only a duplicate parent is still done
+                enqueue(node);
+            } else {
+                node->state = JobGraph::Blocked;
+            }
+            QString log = QString("Uuid:\n"
+                                  "%1\n\n"
+                                  "Command:\n"
+                                  "%2 %3\n")
+                                  .arg(job->uuid().toString())
+                                  .arg(job->command())
+                                  .arg(job->arguments().join(' '));
+            job->setLog(log);
+            mirror(jobUuid);
+        }
     }
     processNextJobs();
 }
@@ -197,317 +541,1245 @@ QueuePrivate::restart(const QUuid& uuid)
 void
 QueuePrivate::remove(const QUuid& uuid)
 {
-    QList<QUuid> dependentUuids;
+    QList<QUuid> uuids;
     {
         QMutexLocker locker(&mutex);
-        if (allJobs.contains(uuid)) {
-            QSharedPointer<Job> job = allJobs.take(uuid);
-            removedJobs.insert(uuid, job); // mark as removed for threads
-            if (job->status() == Job::Running) {
-                int pid = job->pid();
-                if (pid > 0) {
-                    Process::kill(job->pid());
-                }
-            }
-            for (auto it = allJobs.begin(); it != allJobs.end(); ++it) {
-                QSharedPointer<Job> job = it.value();
-                if (job->dependson() == uuid) {
-                    dependentUuids.append(job->uuid());
+        if (graph.contains(uuid)) {
+            uuids = graph.descendants(uuid);
+            uuids.prepend(uuid);
+            std::reverse(uuids.begin(), uuids.end()); // children before parents
+            for (const QUuid& jobUuid : uuids) {
+                QSharedPointer<Job> job = graph.take(jobUuid).job;
+                if (job->status() == Job::Running) {
+                    int pid = job->pid();
+                    if (pid > 0) {
+                        Process::kill(job->pid());
+                    }
                 }
+                journalChanged(journal.removed(jobUuid));
+                discard(job);
+                queue->jobProcessed(jobUuid); // mark as processed, it's not removed
             }
-            dependentJobs.remove(uuid); // prevent from trying to fail dependent deleted jobs
-            waitingJobs.removeAll(job);
-            completedJobs.remove(uuid);
-            queue->jobProcessed(uuid); // mark as processed, it's not removed
         }
     }
-    for (const QUuid& dependentUuid : dependentUuids) {
-        remove(dependentUuid);
+    for (const QUuid& jobUuid : uuids) {
+        queue->jobRemoved(jobUuid);
     }
-    queue->jobRemoved(uuid);
 }
 
 void
-QueuePrivate::processJob(QSharedPointer<Job> job)
+QueuePrivate::discard(QSharedPointer<Job> job)
 {
-    QString log = job->log();
-    QFileInfo commandInfo(job->command());
-    if (commandInfo.isAbsolute() && !commandInfo.exists()) {
-        log += QString("\nCommand error:\nCommand path could not be found: %1\n").arg(job->command());
-        job->setStatus(Job::Failed);
-    } else {
-        QString command = job->command();
-        if (!commandInfo.isAbsolute()) {
-            QSettings settings(MACOSX_BUNDLE_GUI_IDENTIFIER, "Jobman");
-            QStringList searchpaths = settings.value("searchpaths", QStringList()).toStringList();
-            for(QString searchpath : searchpaths) {
-                QString filepath = QDir::cleanPath(QDir(searchpath).filePath(command));
-                if (QFile::exists(filepath)) {
-                    command = filepath;
-                    break;
-                }
-            }
-        }
-        job->setStatus(Job::Running);
-        bool exists = false;
-        QString output = job->output();
-        QFileInfo dirInfo(output);
-        if (!dirInfo.exists()) {
-            QDir dir;
-            if (!dir.mkdir(output)) {
-                log += QString("\nStatus:\n"
-                               "Could not create directory: %1\n")
-                               .arg(output);
-                
-                job->setStatus(Job::Failed);
-            } else {
-                exists = true;
-            }
-        } else if (!dirInfo.isDir()) {
-            log += QString("\nStatus:\n"
-                               "Output exists but is not a directory: %1\n")
-                               .arg(output);
-            job->setStatus(Job::Failed);
-        } else {
-            exists = true;
-        }
-        if (exists)
-        {
-            bool failed = false;
-            bool stopped = false;
-            QScopedPointer<Process> process(new Process());
-            QString standardoutput;
-            QString standarderror;
-            if (process->exists(command)) {
-                process->run(command, job->arguments(), job->startin());
-                int pid = process->pid();
-                job->setPid(pid);
-                log += QString("\nProcess id:\n%1\n").arg(pid);
-                job->setLog(log);
-                if (process->wait()) {
-                    job->setStatus(Job::Completed);
-                    log += QString("\nStatus:\n%1\n").arg("Command completed");
-                } else {
-                    if (job->status() == Job::Stopped) {
-                        stopped = true;
-                    } else {
-                        failed = true;
-                    }
-                }
-                standardoutput = process->standardOutput();
-                standarderror = process->standardError();
-            } else {
-                standarderror = "Command does not exists, make sure command can be "
-                                "found in system or application search paths";
-                failed = true;
-            }
-            if (failed) {
-                log += QString("\nStatus:\n%1\n").arg("Command failed");
-                log += QString("\nExit code:\n%1\n").arg(process->exitCode());
-                switch(process->exitStatus())
-                {
-                    case Process::Normal: {
-                        log += QString("\nExit status:\n%1\n").arg("Normal");
-                    }
-                    break;
-                    case Process::Crash: {
-                        log += QString("\nExit status:\n%1\n").arg("Crash");
-                    }
-                    break;
-                }
-                job->setStatus(Job::Failed);
-                
-            }
-            if (stopped) {
-                log += QString("\nStatus:\n%1\n").arg("Command stopped");
-            }
-            if (!standardoutput.isEmpty()) {
-                log += QString("\nCommand output:\n%1").arg(standardoutput);
+    // everything kept for a job that has left the graph
+    QUuid uuid = job->uuid();
+    unqueue(job);
+    detach(job);
+    forced.remove(uuid);
+    trace.forget(uuid);
+    logs.remove(uuid);
+    {
+        QMutexLocker locker(&retiredmutex);
+        retired.remove(uuid);
+        finishedat.remove(uuid);
+    }
+    QFile::remove(captureFile(uuid, "stdout"));
+    QFile::remove(captureFile(uuid, "stderr"));
+}
+
+void
+QueuePrivate::dispatchJobs(const QList<QSharedPointer<Job>>& jobs)
+{
+    // in incremental mode jobs are checked like make, a job whose declared output is
+    // newer than its input is skipped. dependents are only checked when their parent
+    // was skipped too, a parent that ran may have changed what they consume
+    QSet<QUuid> checked;
+    {
+        QMutexLocker locker(&mutex);
+        for (const QSharedPointer<Job>& job : jobs) {
+            bool force = forced.remove(job->uuid());
+            if (!incremental || force || job->outputfile().isEmpty()) {
+                continue;
             }
-            if (!standarderror.isEmpty()) {
-                log += QString("\nCommand error:\n%1").arg(standarderror);
+            QSharedPointer<Job> parent = graph.job(job->dependson());
+            if (job->dependson().isNull() || (parent && parent->status() == Job::Skipped)) {
+                checked.insert(job->uuid());
             }
         }
     }
-    job->setLog(log);
-    if (job->status() == Job::Failed) {
-        if (!job->dependson().isNull()) {
-            failCompletedJobs(job->uuid(), job->dependson());
+    for (const QSharedPointer<Job>& job : jobs) {
+        trace.begin(job->uuid());
+        if (checked.contains(job->uuid())) {
+            checkJob(job); // processed or skipped once its outputs are stat'ed
+        } else {
+            processJob(job);
         }
     }
-    if (job->status() != Job::Stopped) {
-        queue->jobProcessed(job->uuid());
-    }
 }
 
-QSharedPointer<Job>
-QueuePrivate::findNextJob()
+void
+QueuePrivate::checkJob(QSharedPointer<Job> job)
 {
-    int selectedIndex = 0;
-    QSharedPointer<Job> selectedJob = waitingJobs.first();
-    for (int i = 1; i < waitingJobs.size(); ++i) {
-        QSharedPointer<Job> job = waitingJobs[i];
-        if (job->status() == Job::Waiting) {
-            if (job->priority() > selectedJob->priority()) {
-                selectedJob = job;
-                selectedIndex = i;
+    // stat on the hash pool like hashing, a slow or network volume would stall
+    // dispatch and completions on the queue thread. each job goes on once its
+    // own stat returns, the pool runs them side by side
+    QtConcurrent::run(&hashpool, [this, job]() {
+        bool uptodate = upToDate(job);
+        QMetaObject::invokeMethod(this, [this, job, uptodate]() {
+            bool removed = false;
+            {
+                QMutexLocker locker(&mutex);
+                removed = !graph.contains(job->uuid());
             }
-            else if (job->priority() == selectedJob->priority() && job->created() < selectedJob->created()) {
-                selectedJob = job;
-                selectedIndex = i;
+            if (removed) {
+                job->appendLog(JobLog::Status, QString("\nStatus:\n%1\n").arg("Command stopped"));
+                completeJob(job);
+                return;
             }
-        }
-    }
-    return waitingJobs.takeAt(selectedIndex);
+            if (uptodate) {
+                skipJob(job);
+            } else {
+                processJob(job);
+            }
+        }, Qt::QueuedConnection);
+    });
 }
 
-void
-QueuePrivate::processNextJobs()
+bool
+QueuePrivate::upToDate(QSharedPointer<Job> job)
 {
-    QMutexLocker locker(&mutex);
-    int free = threadPool.maxThreadCount() - threadPool.activeThreadCount();
-    int jobsprocess = qMin(waitingJobs.size(), free);
-    if (jobsprocess == 0) {
-        return;
-    }
-    QList<QSharedPointer<Job>> jobsrun;
-    for (int i = 0; i < jobsprocess; ++i) {
-        if (!waitingJobs.isEmpty()) {
-            jobsrun.append(findNextJob());
-        }
-    }
-    for (QSharedPointer<Job>& job : jobsrun) {
-        QFuture<void> future = QtConcurrent::run(&threadPool, [this, job]() {
-            processJob(job);
-        });
-        QFutureWatcher<void>* watcher = new QFutureWatcher<void>();
-        connect(watcher, &QFutureWatcher<void>::finished, this, [this, watcher, job]() {
-            watcher->deleteLater();
-            statusChanged(job->uuid(), job->status());
-        });
-        watcher->setFuture(future);
-    }
+    QFileInfo input(job->input());
+    QFileInfo output(job->outputfile());
+    return input.exists() && output.exists() && output.lastModified() >= input.lastModified();
 }
 
 void
-QueuePrivate::processRemovedJobs()
+QueuePrivate::skipJob(QSharedPointer<Job> job)
 {
-    removedJobs.clear(); // safe to clear at submit, all event are processed
+    job->appendLog(JobLog::Status, QString("\nStatus:\n%1\n").arg("Output is up to date, skipped"));
+    job->appendLog(JobLog::Status, QString("\nOutput:\n%1\n").arg(job->outputfile()));
+    job->setStatus(Job::Skipped);
+    completeJob(job);
 }
 
 void
-QueuePrivate::processDependentJobs(const QUuid& dependsonId)
+QueuePrivate::processJob(QSharedPointer<Job> job)
 {
-    if (dependentJobs.contains(dependsonId)) {
-        for (QSharedPointer<Job> job : dependentJobs[dependsonId]) {
-            waitingJobs.append(job);
+    job->setAttempt(job->attempt() + 1);
+    if (executor) {
+        job->setStatus(Job::Running);
+        job->setStatus(executor->run(job) == 0 ? Job::Completed : Job::Failed);
+        completeJob(job);
+        return;
+    }
+    QString command = CommandCache::instance()->resolve(job->command());
+    if (command.isEmpty() && QFileInfo(job->command()).isAbsolute()) {
+        job->appendLog(JobLog::Status, QString("\nCommand error:\nCommand path could not be found: %1\n").arg(job->command()));
+        job->setStatus(Job::Failed);
+        completeJob(job);
+        return;
+    }
+    job->setStatus(Job::Running);
+    QString output = job->output();
+    QFileInfo dirInfo(output);
+    if (!dirInfo.exists()) {
+        QDir dir;
+        if (!dir.mkdir(output)) {
+            job->appendLog(JobLog::Status, QString("\nStatus:\n"
+                                                   "Could not create directory: %1\n")
+                                                   .arg(output));
+            job->setStatus(Job::Failed);
+            completeJob(job);
+            return;
         }
-        dependentJobs.remove(dependsonId);
+    } else if (!dirInfo.isDir()) {
+        job->appendLog(JobLog::Status, QString("\nStatus:\n"
+                                               "Output exists but is not a directory: %1\n")
+                                               .arg(output));
+        job->setStatus(Job::Failed);
+        completeJob(job);
+        return;
+    }
+    if (job->cache() && !command.isEmpty()) {
+        hashJob(job, command); // spawned once the key is known
+        return;
     }
+    spawnJob(job, command);
 }
 
 void
-QueuePrivate::failDependentJobs(const QUuid& dependsonId) {
-    
-    if (dependentJobs.contains(dependsonId)) {
-        for (QSharedPointer<Job> job : dependentJobs[dependsonId]) {
-            QString log = QString("Uuid:\n"
-                                  "%1\n\n"
-                                  "Command:\n"
-                                  "%2 %3\n\n"
-                                  "Status:\n"
-                                  "Command cancelled, dependent job failed: %4")
-                                  .arg(job->uuid().toString())
-                                  .arg(job->command())
-                                  .arg(job->arguments().join(' '))
-                                  .arg(dependsonId.toString());
-            job->setLog(log);
-            job->setStatus(Job::Failed);
-            queue->jobProcessed(job->uuid());
-            notifyStatusChanged(job->uuid(), job->status());
-            failDependentJobs(job->uuid());
+QueuePrivate::spawnJob(QSharedPointer<Job> job, const QString& command)
+{
+    QSharedPointer<Process> process(new Process());
+    if (!command.isEmpty()) {
+        // completion is reported by the supervisor, no thread is held while the command runs
+        connect(process.data(), &Process::finished, this, [this, job]() {
+            finishJob(job);
+        }, Qt::QueuedConnection);
+        processes.insert(job->uuid(), process);
+        process->setCapture(Capacity, captureFile(job->uuid(), "stdout"), captureFile(job->uuid(), "stderr"));
+        QElapsedTimer spawn;
+        spawn.start();
+        process->run(command, job->arguments(), job->startin());
+        int pid = process->pid();
+        if (pid > 0) {
+            metrics.observe("jobman_spawn_latency_seconds", spawn.nsecsElapsed() / 1e9, labels(job));
+            spawned.insert(job->uuid(), clock.elapsed());
+            trace.spawned(job->uuid());
+            job->setPid(pid);
+            job->appendLog(JobLog::Status, QString("\nProcess id:\n%1\n").arg(pid));
+            watchJob(job, pid);
+            return;
         }
-        dependentJobs.remove(dependsonId);
+        processes.remove(job->uuid());
+        cached.remove(job->uuid());
+        job->appendLog(JobLog::Status, QString("\nStatus:\n%1\n").arg("Command failed"));
+        job->appendLog(JobLog::Status, QString("\nCommand error:\n%1\n").arg("Command could not be started"));
+    } else {
+        job->appendLog(JobLog::Status, QString("\nStatus:\n%1\n").arg("Command failed"));
+        job->appendLog(JobLog::Status, QString("\nCommand error:\n%1").arg("Command does not exists, make sure command can be "
+                                                                           "found in system or application search paths"));
     }
+    job->setStatus(Job::Failed);
+    completeJob(job);
 }
 
 void
-QueuePrivate::failCompletedJobs(const QUuid& uuid, const QUuid& dependsonId)
+QueuePrivate::finishJob(QSharedPointer<Job> job)
 {
-    if (allJobs.contains(dependsonId)) {
-        QSharedPointer<Job> job = allJobs[dependsonId];
-        QString log = job->log();
-        log += QString("\nDependent error:\n%1").arg("Dependent job failed: %1").arg(uuid.toString());
-        job->setLog(log);
-        job->setStatus(Job::Dependency);
-        if (!job->dependson().isNull()) {
-            failCompletedJobs(dependsonId, job->dependson());
+    QSharedPointer<Process> process = processes.take(job->uuid());
+    if (process.isNull()) {
+        return;
+    }
+    QString timeout = timeouts.take(job->uuid());
+    cpulimited.remove(job->uuid());
+    auto started = spawned.constFind(job->uuid());
+    if (started != spawned.constEnd()) {
+        metrics.observe("jobman_runtime_seconds", (clock.elapsed() - started.value()) / 1000.0, labels(job));
+        spawned.erase(started);
+    }
+    int delay = -1;
+    if (!timeout.isEmpty() && job->status() != Job::Stopped) {
+        job->setStatus(Job::Timeout);
+        job->appendLog(JobLog::Status, QString("\nStatus:\n%1\n").arg("Command timed out"));
+        job->appendLog(JobLog::Status, QString("\nTimeout:\n%1\n").arg(timeout));
+    } else if (process->exitCode() == 0) {
+        job->setStatus(Job::Completed);
+        job->appendLog(JobLog::Status, QString("\nStatus:\n%1\n").arg("Command completed"));
+    } else if (job->status() == Job::Stopped) {
+        job->appendLog(JobLog::Status, QString("\nStatus:\n%1\n").arg("Command stopped"));
+    } else {
+        job->appendLog(JobLog::Status, QString("\nStatus:\n%1\n").arg("Command failed"));
+        job->appendLog(JobLog::Status, QString("\nExit code:\n%1\n").arg(process->exitCode()));
+        switch(process->exitStatus())
+        {
+            case Process::Normal: {
+                job->appendLog(JobLog::Status, QString("\nExit status:\n%1\n").arg("Normal"));
+            }
+            break;
+            case Process::Crash: {
+                job->appendLog(JobLog::Status, QString("\nExit status:\n%1\n").arg("Crash"));
+            }
+            break;
+        }
+        delay = retryDelay(job, process->exitCode());
+        if (delay < 0) {
+            job->setStatus(Job::Failed);
         }
     }
+    QString standardoutput = process->standardOutput();
+    QString standarderror = process->standardError();
+    if (!standardoutput.isEmpty()) {
+        job->appendLog(JobLog::Output, QString("\nCommand output:\n%1").arg(standardoutput));
+    }
+    if (!standarderror.isEmpty()) {
+        job->appendLog(JobLog::Error, QString("\nCommand error:\n%1").arg(standarderror));
+    }
+    cacheJob(job);
+    if (delay >= 0) {
+        retryJob(job, delay);
+    } else {
+        completeJob(job);
+    }
 }
 
 void
-QueuePrivate::statusChanged(const QUuid& uuid, Job::Status status)
+QueuePrivate::completeJob(QSharedPointer<Job> job)
 {
+    if (job->status() == Job::Completed || job->status() == Job::Skipped) {
+        metrics.increment("jobman_jobs_completed_total", labels(job));
+    } else if (job->status() == Job::Failed || job->status() == Job::Timeout) {
+        metrics.increment("jobman_jobs_failed_total", labels(job));
+    }
     {
         QMutexLocker locker(&mutex);
-        if (!removedJobs.contains(uuid)) {
-            if (status == Job::Completed) {
-                completedJobs.insert(uuid); // Mark the job as completed
-                processDependentJobs(uuid);
-            } else if (status == Job::Failed) {
-                failDependentJobs(uuid);
-            }
+        release(job);
+        if ((job->status() == Job::Failed || job->status() == Job::Timeout) && !job->dependson().isNull()) {
+            failCompletedJobs(job->uuid());
         }
     }
-    processNextJobs();
-}
-
-#include "queue.moc"
-
-Queue::Queue()
-: p(new QueuePrivate())
-{
-    p->moveToThread(&p->thread);
-    p->queue = this;
-    p->init();
-    p->thread.start();
+    if (job->status() != Job::Stopped) {
+        queue->jobProcessed(job->uuid());
+    }
+    statusChanged(job->uuid(), job->status());
 }
 
-Queue::~Queue()
+void
+QueuePrivate::hashJob(QSharedPointer<Job> job, const QString& command)
 {
-    p->threadPool.waitForDone();
-    p->thread.quit();
-    p->thread.wait();
+    // the input is hashed on a pool of its own, a large media file would stall
+    // dispatch and completions on the queue thread
+    QtConcurrent::run(&hashpool, [this, job, command]() {
+        QString key = cache.key(job->input(), command, job->arguments(), job->startin(), job->output());
+        QMetaObject::invokeMethod(this, [this, job, command, key]() {
+            bool removed = false;
+            {
+                QMutexLocker locker(&mutex);
+                removed = !graph.contains(job->uuid());
+            }
+            if (removed || job->status() != Job::Running) { // stopped or removed while hashing
+                job->appendLog(JobLog::Status, QString("\nStatus:\n%1\n").arg("Command stopped"));
+                completeJob(job);
+                return;
+            }
+            if (!key.isEmpty() && restoreJob(job, key)) {
+                return;
+            }
+            spawnJob(job, command);
+        }, Qt::QueuedConnection);
+    });
 }
 
-Queue*
-Queue::instance()
+bool
+QueuePrivate::restoreJob(QSharedPointer<Job> job, const QString& key)
 {
-    static QMutex mutex;
-    QMutexLocker locker(&mutex);
-    if (!pi) {
-        pi.reset(new Queue());
+    QStringList files;
+    bool restored = cache.restore(key, job->output(), &files);
+    flushCache();
+    if (restored) {
+        job->appendLog(JobLog::Status, QString("\nStatus:\n%1\n").arg("Restored from cache"));
+        job->appendLog(JobLog::Status, QString("\nCache:\n%1\n").arg(files.join("\n")));
+        job->setStatus(Job::Completed);
+        completeJob(job);
+        return true;
     }
-    return pi.data();
+    cached.insert(job->uuid(), Cached { key, QDateTime::currentDateTime() });
+    return false;
 }
 
-QUuid
-Queue::submit(QSharedPointer<Job> job)
+void
+QueuePrivate::cacheJob(QSharedPointer<Job> job)
 {
-    return p->submit(job);
+    Cached entry = cached.take(job->uuid());
+    if (entry.key.isEmpty() || job->status() != Job::Completed) {
+        return;
+    }
+    // only the declared output, siblings writing next to it belong to other tasks
+    QFileInfo info(job->outputfile());
+    QDateTime since = entry.started.addSecs(-1); // coarse filesystem timestamps
+    QStringList files;
+    if (info.isFile() && info.absolutePath() == QFileInfo(job->output()).absoluteFilePath() && info.lastModified() >= since) {
+        files.append(info.absoluteFilePath());
+    }
+    if (cache.store(entry.key, job->output(), files)) {
+        job->appendLog(JobLog::Status, QString("\nCache:\nStored %1 files\n").arg(files.size()));
+        flushCache();
+    }
 }
 
 void
-Queue::start(const QUuid& uuid)
+QueuePrivate::flushCache()
 {
-    p->start(uuid);
+    // the index is rewritten at most once per interval, not on every hit
+    if (!indexer) {
+        indexer = new QTimer(this);
+        indexer->setSingleShot(true);
+        connect(indexer, &QTimer::timeout, this, [this]() {
+            cache.flush();
+        });
+    }
+    if (!indexer->isActive()) {
+        indexer->start(Index);
+    }
 }
 
 void
-Queue::stop(const QUuid& uuid)
+QueuePrivate::retryJob(QSharedPointer<Job> job, int delay)
 {
-    p->stop(uuid);
+    job->appendLog(JobLog::Status, QString("\nRetry:\nAttempt %1 of %2 failed, retrying in %3 ms\n")
+                                   .arg(job->attempt())
+                                   .arg(job->retry().attempts)
+                                   .arg(delay));
+    job->setStatus(Job::Waiting);
+    QUuid uuid = job->uuid();
+    {
+        QMutexLocker locker(&mutex);
+        release(job);
+        JobGraph::Node* node = graph.node(uuid);
+        if (node) {
+            node->state = JobGraph::Delayed; // dependents stay blocked, no slot is held
+        }
+    }
+    QTimer::singleShot(delay, this, [this, uuid]() {
+        {
+            QMutexLocker locker(&mutex);
+            JobGraph::Node* node = graph.node(uuid);
+            if (node && node->state == JobGraph::Delayed) { // not removed or restarted meanwhile
+                enqueue(node);
+            }
+        }
+        processNextJobs();
+    });
+    processNextJobs();
+}
+
+int
+QueuePrivate::retryDelay(QSharedPointer<Job> job, int exitCode) const
+{
+    Retry retry = job->retry();
+    int attempt = job->attempt();
+    if (attempt >= retry.attempts) {
+        return -1;
+    }
+    bool retryable = retry.exitcodes.isEmpty() && retry.exitsignals.isEmpty();
+    if (exitCode > 0) {
+        retryable = retryable || retry.exitcodes.contains(exitCode);
+    } else if (exitCode < 0) {
+        retryable = retryable || retry.exitsignals.contains(-exitCode); // killed by signal
+    }
+    if (!retryable) {
+        return -1;
+    }
+    // exponential backoff with jitter so retries of a failed mount don't arrive together
+    double delay = qMin<double>(retry.delay * std::pow(retry.multiplier, attempt - 1), retry.maxdelay);
+    delay *= 1.0 + retry.jitter * (2.0 * QRandomGenerator::global()->generateDouble() - 1.0);
+    return qMax(0, static_cast<int>(delay));
+}
+
+void
+QueuePrivate::release(QSharedPointer<Job> job)
+{
+    trace.end(job->uuid(), job->status());
+    Reservation reservation = reservations.take(job->uuid());
+    usedcpus -= reservation.cpus;
+    usedmemory -= reservation.memory;
+    QString pool = job->pool();
+    if (!pool.isEmpty()) {
+        pools[pool].used--;
+        unpark(pool);
+    }
+}
+
+void
+QueuePrivate::watchJob(QSharedPointer<Job> job, int pid)
+{
+    QUuid uuid = job->uuid();
+    int timeout = job->timeout();
+    if (timeout > 0) {
+        QTimer::singleShot(timeout * 1000, this, [this, uuid, pid, timeout]() {
+            timeoutJob(uuid, pid, QString("Exceeded wall clock limit of %1 seconds").arg(timeout));
+        });
+    }
+    if (job->cputimeout() > 0) {
+        cpulimited.insert(uuid, job);
+        if (!watchdog) {
+            watchdog = new QTimer(this);
+            watchdog->setInterval(Watchdog);
+            connect(watchdog, &QTimer::timeout, this, &QueuePrivate::checkCpuTime);
+        }
+        if (!watchdog->isActive()) {
+            watchdog->start();
+        }
+    }
+}
+
+void
+QueuePrivate::timeoutJob(const QUuid& uuid, int pid, const QString& reason)
+{
+    QSharedPointer<Process> process = processes.value(uuid);
+    if (process.isNull() || process->pid() != pid || timeouts.contains(uuid)) {
+        return; // finished, retried or already terminating
+    }
+    timeouts.insert(uuid, reason);
+    Process::terminate(pid);
+    QTimer::singleShot(Grace, this, [this, uuid, pid]() {
+        QSharedPointer<Process> process = processes.value(uuid);
+        if (!process.isNull() && process->pid() == pid) {
+            Process::kill(pid); // ignored terminate
+        }
+    });
+}
+
+void
+QueuePrivate::checkCpuTime()
+{
+    if (cpulimited.isEmpty()) {
+        watchdog->stop();
+        return;
+    }
+    const QList<QSharedPointer<Job>> jobs = cpulimited.values();
+    QList<int> pids;
+    for (const QSharedPointer<Job>& job : jobs) {
+        pids.append(job->pid());
+    }
+    QHash<int, qint64> cputimes = Process::cpuTimes(pids); // one scan for every limited job
+    for (const QSharedPointer<Job>& job : jobs) {
+        int pid = job->pid();
+        qint64 cputime = cputimes.value(pid, -1);
+        if (cputime > job->cputimeout() * 1000LL) {
+            timeoutJob(job->uuid(), pid, QString("Exceeded cpu time limit of %1 seconds").arg(job->cputimeout()));
+        }
+    }
+}
+
+void
+QueuePrivate::retire(const QUuid& uuid)
+{
+    // called from the thread that finished the job, often with the queue locked
+    QMutexLocker locker(&retiredmutex);
+    bool first = retired.isEmpty();
+    retired.insert(uuid, clock.elapsed());
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    finishedat.insert(uuid, now);
+    if (retaining) {
+        finishorder.insert(now, uuid);
+    }
+    if (first) {
+        QMetaObject::invokeMethod(this, [this]() {
+            if (!archiver) {
+                archiver = new QTimer(this);
+                archiver->setSingleShot(true);
+                connect(archiver, &QTimer::timeout, this, &QueuePrivate::archiveLogs);
+            }
+            if (!archiver->isActive()) {
+                archiver->start(Archive);
+            }
+        }, Qt::QueuedConnection);
+    }
+}
+
+void
+QueuePrivate::archiveLogs()
+{
+    // logs that stopped changing are compressed to disk off the queue thread,
+    // a job keeps a summary and the whole log is read back when it's shown
+    QList<QUuid> uuids;
+    bool pending = false;
+    {
+        QMutexLocker locker(&retiredmutex);
+        qint64 now = clock.elapsed();
+        for (auto it = retired.begin(); it != retired.end();) {
+            if (now - it.value() >= Archive) {
+                uuids.append(it.key());
+                it = retired.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        pending = !retired.isEmpty();
+    }
+    QList<QSharedPointer<Job>> jobs;
+    {
+        QMutexLocker locker(&mutex);
+        for (const QUuid& uuid : uuids) {
+            QSharedPointer<Job> job = graph.job(uuid);
+            if (job && job->status() != Job::Waiting && job->status() != Job::Running) {
+                jobs.append(job);
+            }
+        }
+    }
+    if (!jobs.isEmpty() && archiving.isFinished()) {
+        archiving = QtConcurrent::run([this, jobs]() {
+            for (const QSharedPointer<Job>& job : jobs) {
+                archiveLog(job);
+            }
+        });
+    } else if (!jobs.isEmpty()) {
+        QMutexLocker locker(&retiredmutex); // still busy with the last round, try again later
+        for (const QSharedPointer<Job>& job : jobs) {
+            retired.insert(job->uuid(), clock.elapsed() - Archive);
+        }
+        pending = true;
+    }
+    if (pending) {
+        archiver->start(Archive);
+    }
+}
+
+void
+QueuePrivate::archiveLog(QSharedPointer<Job> job)
+{
+    qint64 revision = 0;
+    QList<JobLog::Segment> segments = job->logSegments(&revision);
+    if (segments.size() == 1 && segments.first().kind == JobLog::Summary) {
+        return; // nothing added since it was archived
+    }
+    // the job only swaps in its summary if the log didn't change while it was stored
+    if (logs.store(job->uuid(), logText(job->uuid(), segments))) {
+        job->archiveLog(revision);
+    }
+}
+
+QString
+QueuePrivate::logText(const QUuid& uuid, const QList<JobLog::Segment>& segments) const
+{
+    QString text;
+    for (const JobLog::Segment& segment : segments) {
+        if (segment.kind == JobLog::Summary) {
+            QString archived = logs.load(uuid);
+            text += archived.isEmpty() ? segment.text : archived;
+        } else {
+            text += segment.text;
+        }
+    }
+    return text;
+}
+
+void
+QueuePrivate::retain(int jobs, int hours)
+{
+    retainjobs = qMax(0, jobs);
+    retainhours = qMax(0, hours);
+    {
+        // jobs that finished while retention was off are ordered once it's turned on
+        QMutexLocker locker(&retiredmutex);
+        bool enabled = retainjobs || retainhours;
+        if (enabled && !retaining) {
+            for (auto it = finishedat.constBegin(); it != finishedat.constEnd(); ++it) {
+                finishorder.insert(it.value(), it.key());
+            }
+        } else if (!enabled) {
+            finishorder.clear();
+        }
+        retaining = enabled;
+    }
+    if (!retainjobs && !retainhours) {
+        if (evictor) {
+            evictor->stop();
+        }
+        return;
+    }
+    if (!evictor) {
+        evictor = new QTimer(this);
+        connect(evictor, &QTimer::timeout, this, &QueuePrivate::evictJobs);
+    }
+    evictor->start(Retention);
+}
+
+void
+QueuePrivate::evictJobs()
+{
+    // finished jobs are taken oldest first while there are more than retained
+    // or they are too old. a tree is evicted whole from the entry of its last
+    // job to finish, entries of trees still running are dropped and the job
+    // finishing last adds its own. each job leaves a tombstone in the graph and
+    // the journal so jobs submitted later can still depend on it
+    qint64 expired = retainhours ? QDateTime::currentMSecsSinceEpoch() - retainhours * 3600000LL : 0;
+    QList<QUuid> evicted;
+    {
+        QMutexLocker locker(&mutex);
+        while (true) {
+            QUuid candidate;
+            qint64 last = 0;
+            {
+                QMutexLocker retiredlocker(&retiredmutex);
+                if (finishorder.isEmpty()) {
+                    break;
+                }
+                auto first = finishorder.begin();
+                if ((!retainjobs || finishedat.size() <= retainjobs) && first.key() >= expired) {
+                    break;
+                }
+                last = first.key();
+                candidate = first.value();
+                finishorder.erase(first);
+                if (finishedat.value(candidate, -1) != last) {
+                    continue; // removed or finished again since
+                }
+            }
+            QUuid root = candidate;
+            for (const QUuid& ancestor : graph.ancestors(candidate)) {
+                if (graph.contains(ancestor)) {
+                    root = ancestor;
+                }
+            }
+            QList<QUuid> tree = graph.descendants(root);
+            tree.prepend(root);
+            QList<qint64> times;
+            {
+                QMutexLocker retiredlocker(&retiredmutex);
+                for (const QUuid& uuid : tree) {
+                    QSharedPointer<Job> job = graph.job(uuid);
+                    auto it = finishedat.constFind(uuid);
+                    if (!job || !finished(job->status()) || it == finishedat.constEnd() || it.value() > last) {
+                        break;
+                    }
+                    times.append(it.value());
+                }
+            }
+            if (times.size() != tree.size()) {
+                continue;
+            }
+            for (int i = tree.size() - 1; i >= 0; --i) { // children before parents
+                QSharedPointer<Job> job = graph.bury(tree[i], times[i]).job;
+                journalChanged(journal.evicted(tree[i], *graph.tombstone(tree[i])));
+                discard(job);
+                evicted.append(tree[i]);
+            }
+        }
+    }
+    for (const QUuid& uuid : evicted) {
+        queue->jobRemoved(uuid);
+    }
+}
+
+bool
+QueuePrivate::finished(Job::Status status)
+{
+    // stopped jobs can still be started again
+    return status == Job::Completed || status == Job::Skipped || status == Job::Dependency
+        || status == Job::Failed || status == Job::Timeout;
+}
+
+void
+QueuePrivate::exportTo(const QString& target, int interval)
+{
+    metrics.close();
+    metricsfile.clear();
+    if (exporter) {
+        exporter->stop();
+    }
+    if (target.isEmpty()) {
+        return;
+    }
+    if (target.startsWith("unix:")) { // served on a socket, otherwise written to a file
+        if (!metrics.listen(target.mid(5))) {
+            return;
+        }
+    } else {
+        metricsfile = target;
+    }
+    if (!exporter) {
+        exporter = new QTimer(this);
+        connect(exporter, &QTimer::timeout, this, &QueuePrivate::exportMetrics);
+    }
+    exporter->start(qMax(1, interval) * 1000);
+    exportMetrics();
+}
+
+void
+QueuePrivate::exportMetrics()
+{
+    {
+        QMutexLocker locker(&mutex);
+        int depth = waitingJobs.size();
+        for (const Pool& pool : pools) {
+            depth += pool.parked.size();
+        }
+        metrics.set("jobman_queue_depth", depth);
+        metrics.set("jobman_jobs_running", processes.size());
+    }
+    if (!metricsfile.isEmpty()) {
+        metrics.write(metricsfile);
+    } else {
+        metrics.publish();
+    }
+}
+
+Metrics::Labels
+QueuePrivate::labels(QSharedPointer<Job> job)
+{
+    return Metrics::Labels() << qMakePair(QString("preset"), job->preset()) << qMakePair(QString("task"), job->id());
+}
+
+QString
+QueuePrivate::captureFile(const QUuid& uuid, const QString& channel) const
+{
+    return QDir(capturedir).filePath(QString("%1.%2").arg(uuid.toString(QUuid::WithoutBraces)).arg(channel));
+}
+
+int
+QueuePrivate::physicalMemory() const
+{
+    qint64 bytes = 0;
+#if defined(Q_OS_MACOS)
+    size_t size = sizeof(bytes);
+    sysctlbyname("hw.memsize", &bytes, &size, nullptr, 0);
+#else
+    bytes = static_cast<qint64>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+#endif
+    return static_cast<int>(qMax<qint64>(bytes, 0) / (1024 * 1024));
+}
+
+QueuePrivate::Reservation
+QueuePrivate::reserve(QSharedPointer<Job> job) const
+{
+    // never ask for more than the machine has, heavy jobs then run alone
+    Reservation reservation;
+    reservation.cpus = qBound(1, job->cpus(), qMax(1, threads));
+    reservation.memory = (memory > 0) ? qBound(0, job->memory(), memory) : 0;
+    return reservation;
+}
+
+void
+QueuePrivate::enqueue(JobGraph::Node* node)
+{
+    node->state = JobGraph::Ready;
+    node->enqueued = clock.elapsed();
+    waitingJobs.push(node->job, key(node), node->sequence);
+    trace.ready(node->job->uuid());
+}
+
+JobGraph::Node*
+QueuePrivate::attach(QSharedPointer<Job> job)
+{
+    // the same work is queued, running or done, follow it instead of running it again
+    auto it = fingerprints.constFind(fingerprint(job));
+    if (it == fingerprints.constEnd() || !graph.contains(it.value())) {
+        return nullptr;
+    }
+    QUuid uuid = it.value();
+    JobGraph::Node* node = graph.insert(job, job->dependson(), sequence++);
+    node->state = JobGraph::Blocked; // until the original finishes
+    job->setDuplicateof(uuid);
+    duplicates[uuid].append(job->uuid());
+    return node;
+}
+
+void
+QueuePrivate::detach(QSharedPointer<Job> job)
+{
+    QUuid uuid = job->uuid();
+    if (!job->duplicateof().isNull()) {
+        auto it = duplicates.find(job->duplicateof());
+        if (it != duplicates.end()) {
+            it->removeAll(uuid);
+        }
+        job->setDuplicateof(QUuid());
+        return;
+    }
+    forget(job);
+    // the original is going away, the first duplicate takes over its work
+    QList<QUuid> copies = duplicates.take(uuid);
+    QUuid successor;
+    for (const QUuid& copy : copies) {
+        JobGraph::Node* node = graph.node(copy);
+        if (!node) {
+            continue;
+        }
+        if (successor.isNull()) {
+            successor = copy;
+            node->job->setDuplicateof(QUuid());
+            fingerprints.insert(fingerprint(node->job), copy);
+            if (node->state == JobGraph::Blocked && graph.isReady(node->dependson)) {
+                enqueue(node);
+            }
+        } else {
+            node->job->setDuplicateof(successor);
+            duplicates[successor].append(copy);
+        }
+    }
+}
+
+void
+QueuePrivate::forget(QSharedPointer<Job> job)
+{
+    auto it = fingerprints.find(fingerprint(job));
+    if (it != fingerprints.end() && it.value() == job->uuid()) {
+        fingerprints.erase(it);
+    }
+}
+
+void
+QueuePrivate::mirror(const QUuid& uuid)
+{
+    auto copies = duplicates.constFind(uuid);
+    JobGraph::Node* original = graph.node(uuid);
+    if (copies == duplicates.constEnd() || !original) {
+        return;
+    }
+    Job::Status status = original->job->status();
+    for (const QUuid& copy : copies.value()) {
+        JobGraph::Node* node = graph.node(copy);
+        if (!node || node->job->status() == status) {
+            continue;
+        }
+        QSharedPointer<Job> job = node->job;
+        job->setLog(QString("Duplicate of:\n%1\n\n").arg(uuid.toString()) + logText(uuid, original->job->logSegments()));
+        job->setStatus(status);
+        switch (status) {
+            case Job::Completed:
+            case Job::Skipped: {
+                node->state = JobGraph::Done;
+                processDependentJobs(copy);
+                queue->jobProcessed(copy);
+            }
+            break;
+            case Job::Dependency: {
+                node->state = JobGraph::Done;
+            }
+            break;
+            case Job::Failed:
+            case Job::Timeout: {
+                node->state = JobGraph::Failed;
+                failDependentJobs(copy);
+                queue->jobProcessed(copy);
+            }
+            break;
+            case Job::Stopped: {
+                node->state = JobGraph::Stopped;
+            }
+            break;
+            default: {
+                node->state = JobGraph::Blocked;
+            }
+            break;
+        }
+    }
+}
+
+QUuid
+QueuePrivate::original(const QUuid& uuid) const
+{
+    const JobGraph::Node* node = graph.node(uuid);
+    if (node && !node->job->duplicateof().isNull() && graph.contains(node->job->duplicateof())) {
+        return node->job->duplicateof();
+    }
+    return uuid;
+}
+
+QByteArray
+QueuePrivate::fingerprint(QSharedPointer<Job> job)
+{
+    // what the job runs and where it writes, two jobs alike would race on the same outputs
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QStringList parts = QStringList() << job->command() << job->startin() << job->output() << job->outputfile();
+    parts << job->arguments();
+    for (const QString& part : parts) {
+        hash.addData(part.toUtf8());
+        hash.addData(QByteArray(1, '\0'));
+    }
+    return hash.result();
+}
+
+qint64
+QueuePrivate::key(const JobGraph::Node* node) const
+{
+    // effective priority grows by aging points per minute of waiting. comparing
+    // priority + aging * (now - enqueued) between jobs is the same as comparing
+    // priority - aging * enqueued, so keys stay fixed while jobs wait
+    return static_cast<qint64>(node->job->priority()) * Minute - static_cast<qint64>(aging) * node->enqueued;
+}
+
+void
+QueuePrivate::rekey()
+{
+    for (const QSharedPointer<Job>& job : graph.jobs()) {
+        JobGraph::Node* node = graph.node(job->uuid());
+        if (node->state == JobGraph::Ready && !waitingJobs.update(node->job->uuid(), key(node))) {
+            for (Pool& pool : pools) {
+                if (pool.parked.update(node->job->uuid(), key(node))) {
+                    break;
+                }
+            }
+        }
+    }
+}
+
+void
+QueuePrivate::unqueue(QSharedPointer<Job> job)
+{
+    QUuid uuid = job->uuid();
+    if (!waitingJobs.remove(uuid)) {
+        auto it = pools.find(job->pool());
+        if (it != pools.end()) {
+            it->parked.remove(uuid);
+        }
+    }
+}
+
+void
+QueuePrivate::park(QSharedPointer<Job> job)
+{
+    QUuid uuid = job->uuid();
+    qint64 key = waitingJobs.key(uuid);
+    waitingJobs.remove(uuid);
+    pools[job->pool()].parked.push(job, key, graph.node(uuid)->sequence);
+}
+
+void
+QueuePrivate::unpark(const QString& name)
+{
+    // move back as many jobs as the pool has room for, others stay parked
+    Pool& pool = pools[name];
+    int free = (pool.limit > 0) ? pool.limit - pool.used : pool.parked.size();
+    while (free-- > 0 && !pool.parked.isEmpty()) {
+        QUuid uuid = pool.parked.top()->uuid();
+        qint64 key = pool.parked.key(uuid);
+        QSharedPointer<Job> job = pool.parked.pop();
+        waitingJobs.push(job, key, graph.node(uuid)->sequence);
+    }
+}
+
+bool
+QueuePrivate::saturated(const QString& name) const
+{
+    if (name.isEmpty()) {
+        return false;
+    }
+    auto it = pools.constFind(name);
+    return it != pools.constEnd() && it->limit > 0 && it->used >= it->limit;
+}
+
+void
+QueuePrivate::priorityChanged(const QUuid& uuid, int priority)
+{
+    QMutexLocker locker(&mutex);
+    journalChanged(journal.priorityChanged(uuid, priority));
+    JobGraph::Node* node = graph.node(uuid);
+    if (!node || node->state != JobGraph::Ready) {
+        return;
+    }
+    qint64 nodekey = key(node);
+    if (!waitingJobs.update(uuid, nodekey)) { // reprioritise in place
+        for (Pool& pool : pools) {
+            if (pool.parked.update(uuid, nodekey)) {
+                break;
+            }
+        }
+    }
+}
+
+QSharedPointer<Job>
+QueuePrivate::findNextJob()
+{
+    QSharedPointer<Job> job = waitingJobs.pop();
+    waitingJobs.charge(job); // advances the batch in fair share order
+    JobGraph::Node* node = graph.node(job->uuid());
+    node->state = JobGraph::Running;
+    trace.dispatch(job->uuid());
+    metrics.increment("jobman_jobs_dispatched_total", labels(job));
+    metrics.observe("jobman_queue_wait_seconds", (clock.elapsed() - node->enqueued) / 1000.0, labels(job));
+    return job;
+}
+
+void
+QueuePrivate::processNextJobs()
+{
+    QList<QSharedPointer<Job>> jobsrun;
+    {
+        QMutexLocker locker(&mutex);
+        // pack jobs against free cpu slots and memory, the first job that doesn't
+        // fit keeps its reservation so lighter jobs only backfill what it can't use
+        struct Skipped {
+            QSharedPointer<Job> job;
+            qint64 key;
+            quint64 sequence;
+        };
+        QList<Skipped> skipped;
+        Reservation reserved { 0, 0 };
+        while (!waitingJobs.isEmpty() && usedcpus + reserved.cpus < threads && skipped.size() < Lookahead) {
+            QSharedPointer<Job> job = waitingJobs.top();
+            QUuid uuid = job->uuid();
+            QString pool = job->pool();
+            if (saturated(pool)) {
+                park(job); // other tools keep flowing
+                continue;
+            }
+            Reservation reservation = reserve(job);
+            bool fits = usedcpus + reserved.cpus + reservation.cpus <= threads &&
+                        (memory <= 0 || usedmemory + reserved.memory + reservation.memory <= memory);
+            if (fits) {
+                jobsrun.append(findNextJob());
+                reservations.insert(uuid, reservation);
+                usedcpus += reservation.cpus;
+                usedmemory += reservation.memory;
+                if (!pool.isEmpty()) {
+                    pools[pool].used++;
+                }
+            } else {
+                if (skipped.isEmpty()) {
+                    reserved = reservation;
+                }
+                skipped.append(Skipped { job, waitingJobs.key(uuid), graph.node(uuid)->sequence });
+                waitingJobs.pop();
+            }
+        }
+        for (const Skipped& entry : skipped) {
+            waitingJobs.push(entry.job, entry.key, entry.sequence);
+        }
+    }
+    if (!jobsrun.isEmpty()) {
+        QMetaObject::invokeMethod(this, [this, jobsrun]() {
+            dispatchJobs(jobsrun);
+        }, Qt::QueuedConnection);
+    }
+}
+
+void
+QueuePrivate::processDependentJobs(const QUuid& dependsonId)
+{
+    for (const QUuid& uuid : graph.dependents(dependsonId)) {
+        JobGraph::Node* node = graph.node(uuid);
+        if (node && node->state == JobGraph::Blocked && node->job->duplicateof().isNull()) {
+            trace.release(uuid);
+            enqueue(node);
+        }
+    }
+}
+
+void
+QueuePrivate::failDependentJobs(const QUuid& dependsonId)
+{
+    QList<QUuid> uuids = graph.dependents(dependsonId);
+    for (int i = 0; i < uuids.size(); ++i) {
+        JobGraph::Node* node = graph.node(uuids[i]);
+        if (!node || node->state != JobGraph::Blocked) {
+            continue;
+        }
+        cancelJob(node);
+        uuids.append(node->dependents);
+    }
+}
+
+void
+QueuePrivate::failOrphanedJobs(const QList<QUuid>& uuids)
+{
+    // submitted after their parent failed, live or evicted, they fail the way its
+    // dependents did. from the queue thread, after the submit returns
+    if (uuids.isEmpty()) {
+        return;
+    }
+    QMetaObject::invokeMethod(this, [this, uuids]() {
+        QMutexLocker locker(&mutex);
+        for (const QUuid& uuid : uuids) {
+            JobGraph::Node* node = graph.node(uuid);
+            if (node && node->state == JobGraph::Blocked && graph.isFailed(node->dependson)) {
+                cancelJob(node);
+                failDependentJobs(uuid);
+            }
+        }
+    }, Qt::QueuedConnection);
+}
+
+void
+QueuePrivate::cancelJob(JobGraph::Node* node)
+{
+    QSharedPointer<Job> job = node->job;
+    QString log = QString("Uuid:\n"
+                          "%1\n\n"
+                          "Command:\n"
+                          "%2 %3\n\n"
+                          "Status:\n"
+                          "Command cancelled, dependent job failed: %4")
+                          .arg(job->uuid().toString())
+                          .arg(job->command())
+                          .arg(job->arguments().join(' '))
+                          .arg(node->dependson.toString());
+    job->setLog(log);
+    job->setStatus(Job::Failed);
+    node->state = JobGraph::Failed;
+    queue->jobProcessed(job->uuid());
+    if (job->duplicateof().isNull()) {
+        forget(job);
+        mirror(job->uuid());
+    } else {
+        detach(job); // cancelled with its own parent, stop following
+    }
+}
+
+void
+QueuePrivate::failCompletedJobs(const QUuid& uuid)
+{
+    QUuid failedUuid = uuid;
+    for (const QUuid& ancestorUuid : graph.ancestors(uuid)) {
+        QSharedPointer<Job> job = graph.job(ancestorUuid);
+        job->appendLog(JobLog::Status, QString("\nDependent error:\n%1").arg("Dependent job failed: %1").arg(failedUuid.toString()));
+        job->setStatus(Job::Dependency);
+        failedUuid = ancestorUuid;
+    }
+}
+
+void
+QueuePrivate::statusChanged(const QUuid& uuid, Job::Status status)
+{
+    {
+        QMutexLocker locker(&mutex);
+        JobGraph::Node* node = graph.node(uuid);
+        if (node) { // removed jobs are no longer in the graph
+            if (status == Job::Completed || status == Job::Skipped) {
+                node->state = JobGraph::Done;
+                processDependentJobs(uuid);
+            } else if (status == Job::Failed || status == Job::Timeout) {
+                node->state = JobGraph::Failed;
+                forget(node->job); // submitting it again runs it again
+                failDependentJobs(uuid);
+            } else if (status == Job::Stopped) {
+                node->state = JobGraph::Stopped;
+            }
+            mirror(uuid);
+        }
+    }
+    processNextJobs();
+}
+
+#include "queue.moc"
+
+Queue::Queue()
+: p(new QueuePrivate())
+{
+    p->moveToThread(&p->thread);
+    p->queue = this;
+    p->init();
+    p->thread.start();
+}
+
+Queue::~Queue()
+{
+    p->thread.quit();
+    p->thread.wait();
+    p->archiving.waitForFinished();
+    p->hashpool.waitForDone();
+}
+
+Queue*
+Queue::instance()
+{
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    if (!pi) {
+        pi.reset(new Queue());
+    }
+    return pi.data();
+}
+
+QUuid
+Queue::submit(QSharedPointer<Job> job)
+{
+    return p->submit(job);
+}
+
+void
+Queue::submit(QList<QSharedPointer<Job>> jobs)
+{
+    p->submit(jobs);
+}
+
+void
+Queue::restore()
+{
+    p->restore();
+}
+
+void
+Queue::start(const QUuid& uuid)
+{
+    p->start(uuid);
+}
+
+void
+Queue::stop(const QUuid& uuid)
+{
+    p->stop(uuid);
 }
 
 void
@@ -525,13 +1797,208 @@ Queue::remove(const QUuid& uuid)
 int
 Queue::threads() const
 {
+    QMutexLocker locker(&p->mutex);
     return p->threads;
 }
 
 void
 Queue::setThreads(int threads)
 {
-    p->threads = threads;
-    p->update();
+    {
+        QMutexLocker locker(&p->mutex);
+        p->threads = threads;
+    }
+    p->processNextJobs();
+}
+
+int
+Queue::memory() const
+{
+    QMutexLocker locker(&p->mutex);
+    return p->memory;
+}
+
+void
+Queue::setMemory(int memory)
+{
+    {
+        QMutexLocker locker(&p->mutex);
+        p->memory = memory;
+    }
+    p->processNextJobs();
+}
+
+int
+Queue::pool(const QString& name) const
+{
+    QMutexLocker locker(&p->mutex);
+    auto it = p->pools.constFind(name);
+    return (it != p->pools.constEnd()) ? it->limit : 0;
+}
+
+void
+Queue::setPool(const QString& name, int limit)
+{
+    {
+        QMutexLocker locker(&p->mutex);
+        p->pools[name].limit = limit;
+        p->unpark(name);
+    }
+    p->processNextJobs();
+}
+
+int
+Queue::aging() const
+{
+    QMutexLocker locker(&p->mutex);
+    return p->aging;
+}
+
+void
+Queue::setAging(int aging)
+{
+    {
+        QMutexLocker locker(&p->mutex);
+        if (p->aging == aging) {
+            return;
+        }
+        p->aging = aging;
+        p->rekey(); // only when the rate changes, waiting never rescans
+    }
     p->processNextJobs();
 }
+
+QHash<QUuid, int>
+Queue::effectivePriorities() const
+{
+    // waiting jobs only, read back from their keys. a key is priority * minute -
+    // aging * enqueued so the effective priority is (key + aging * now) / minute
+    QMutexLocker locker(&p->mutex);
+    QHash<QUuid, int> priorities;
+    if (p->aging <= 0) {
+        return priorities;
+    }
+    qint64 now = p->clock.elapsed();
+    QHash<QUuid, qint64> keys = p->waitingJobs.keys();
+    for (const QueuePrivate::Pool& pool : p->pools) {
+        keys.insert(pool.parked.keys());
+    }
+    for (auto it = keys.constBegin(); it != keys.constEnd(); ++it) {
+        double minutes = static_cast<double>(it.value() + static_cast<qint64>(p->aging) * now) / QueuePrivate::Minute;
+        priorities.insert(it.key(), static_cast<int>(std::floor(minutes)));
+    }
+    return priorities;
+}
+
+int
+Queue::cacheSize() const
+{
+    return static_cast<int>(p->cache.limit() / (1024 * 1024));
+}
+
+void
+Queue::setCacheSize(int megabytes)
+{
+    p->cache.setLimit(qMax(0, megabytes) * 1024LL * 1024);
+}
+
+bool
+Queue::incremental() const
+{
+    QMutexLocker locker(&p->mutex);
+    return p->incremental;
+}
+
+void
+Queue::setIncremental(bool incremental)
+{
+    QMutexLocker locker(&p->mutex);
+    p->incremental = incremental;
+}
+
+QByteArray
+Queue::metrics() const
+{
+    return p->metrics.exposition();
+}
+
+QString
+Queue::log(QSharedPointer<Job> job) const
+{
+    return p->logText(job->uuid(), job->logSegments());
+}
+
+bool
+Queue::exportTrace(const QString& filename) const
+{
+    return p->trace.write(filename);
+}
+
+void
+Queue::setRetention(int jobs, int hours)
+{
+    QMetaObject::invokeMethod(p.data(), [this, jobs, hours]() {
+        p->retain(jobs, hours);
+    }, Qt::QueuedConnection);
+}
+
+bool
+Queue::history(const QUuid& uuid, Job::Status* status, QDateTime* finished) const
+{
+    // jobs still held first, evicted jobs are answered from their tombstone
+    QMutexLocker locker(&p->mutex);
+    QSharedPointer<Job> job = p->graph.job(uuid);
+    if (job) {
+        Job::Status current = job->status();
+        if (status) {
+            *status = current;
+        }
+        if (finished) {
+            QMutexLocker retiredlocker(&p->retiredmutex);
+            auto it = p->finishedat.constFind(uuid);
+            bool done = it != p->finishedat.constEnd() && QueuePrivate::finished(current);
+            *finished = done ? QDateTime::fromMSecsSinceEpoch(it.value()) : QDateTime();
+        }
+        return true;
+    }
+    const JobGraph::Tombstone* tombstone = p->graph.tombstone(uuid);
+    if (!tombstone) {
+        return false;
+    }
+    if (status) {
+        *status = tombstone->status;
+    }
+    if (finished) {
+        *finished = QDateTime::fromMSecsSinceEpoch(tombstone->finished);
+    }
+    return true;
+}
+
+void
+Queue::setExecutor(Executor* executor)
+{
+    // queued behind dispatches already posted, jobs submitted after this call use it
+    QMetaObject::invokeMethod(p.data(), [this, executor]() {
+        p->executor = executor;
+    }, Qt::QueuedConnection);
+}
+
+void
+Queue::setJournaling(bool journaling)
+{
+    // on by default, changes made while it is off are not recorded and a restart
+    // won't restore them. the journal takes its own lock, it closes right away
+    if (journaling) {
+        p->journal.open(QDir(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation)).filePath("Journal"));
+    } else {
+        p->journal.close();
+    }
+}
+
+void
+Queue::setMetrics(const QString& target, int interval)
+{
+    QMetaObject::invokeMethod(p.data(), [this, target, interval]() {
+        p->exportTo(target, interval);
+    }, Qt::QueuedConnection);
+}
@@ -6,6 +6,8 @@
 
 #include "job.h"
 
+#include <QDateTime>
+#include <QHash>
 #include <QObject>
 #include <QScopedPointer>
 
@@ -13,19 +15,46 @@ class QueuePrivate;
 class Queue : public QObject
 {
     Q_OBJECT
+    public:
+        class Executor {
+            public:
+                virtual ~Executor() = default;
+                virtual int run(QSharedPointer<Job> job) = 0; // exit code, called on the queue thread
+        };
+
     public:
         static Queue* instance();
         QUuid submit(QSharedPointer<Job> job);
         void submit(QList<QSharedPointer<Job>> jobs);
+        void restore();
         void start(const QUuid& uuid);
         void stop(const QUuid& uuid);
         void restart(const QUuid& uuid);
         void remove(const QUuid& uuid);
         int threads() const;
         void setThreads(int threads);
+        int memory() const;
+        void setMemory(int memory);
+        int pool(const QString& name) const;
+        void setPool(const QString& name, int limit);
+        int aging() const;
+        void setAging(int aging);
+        QHash<QUuid, int> effectivePriorities() const;
+        int cacheSize() const;
+        void setCacheSize(int megabytes);
+        bool incremental() const;
+        void setIncremental(bool incremental);
+        QByteArray metrics() const;
+        void setMetrics(const QString& target, int interval);
+        void setRetention(int jobs, int hours);
+        bool history(const QUuid& uuid, Job::Status* status, QDateTime* finished = nullptr) const;
+        QString log(QSharedPointer<Job> job) const;
+        bool exportTrace(const QString& filename) const;
+        void setExecutor(Executor* executor);
+        void setJournaling(bool journaling);
     
     Q_SIGNALS:
-        void jobSubmitted(QSharedPointer<Job> job);
+        void jobsSubmitted(const QList<QSharedPointer<Job>>& jobs);
         void jobProcessed(const QUuid& uuid);
         void jobRemoved(const QUuid& uuid);
 
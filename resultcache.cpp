@@ -0,0 +1,340 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "resultcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QDebug>
+
+#include <algorithm>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(Q_OS_MACOS)
+#include <sys/clonefile.h>
+#else
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+// outputs of cached tasks keyed on a hash of the input contents, the tool
+// binary and the expanded command line. each entry is a directory of copies
+// under objects, the index keeps sizes and last use for lru eviction. cache
+// copies are cloned where the filesystem supports it and restored as clones
+// or hardlinks, an object whose size or mtime changed through a hardlink is
+// dropped instead of restored. the index is written on flush, after a crash
+// entries without objects are skipped and objects without entries removed
+
+ResultCache::ResultCache()
+: total(0)
+, maxsize(1024LL * 1024 * 1024)
+, dirty(false)
+{
+}
+
+ResultCache::~ResultCache()
+{
+    flush();
+}
+
+bool
+ResultCache::open(const QString& directory)
+{
+    QMutexLocker locker(&mutex);
+    path = directory;
+    if (!QDir().mkpath(QDir(path).filePath("objects"))) {
+        qWarning() << "Could not create result cache:" << path;
+        return false;
+    }
+    entries.clear();
+    total = 0;
+    QFile index(indexFile());
+    if (index.open(QIODevice::ReadOnly)) {
+        QJsonObject json = QJsonDocument::fromJson(index.readAll()).object();
+        for (auto it = json.constBegin(); it != json.constEnd(); ++it) {
+            QJsonObject jsonentry = it.value().toObject();
+            Entry entry { {}, 0, static_cast<qint64>(jsonentry["used"].toDouble()) };
+            for (const QJsonValue& value : jsonentry["objects"].toArray()) {
+                QJsonObject jsonobject = value.toObject();
+                Object object {
+                    jsonobject["name"].toString(),
+                    static_cast<qint64>(jsonobject["size"].toDouble()),
+                    static_cast<qint64>(jsonobject["modified"].toDouble())
+                };
+                entry.objects.append(object);
+                entry.size += object.size;
+            }
+            if (QFileInfo(objectDir(it.key())).isDir()) {
+                entries.insert(it.key(), entry);
+                total += entry.size;
+            }
+        }
+    }
+    // objects without an index entry are left over from a crash
+    QDir objects(QDir(path).filePath("objects"));
+    for (const QString& name : objects.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+        if (!entries.contains(name)) {
+            QDir(objects.filePath(name)).removeRecursively();
+        }
+    }
+    evict();
+    return true;
+}
+
+qint64
+ResultCache::limit() const
+{
+    QMutexLocker locker(&mutex);
+    return maxsize;
+}
+
+void
+ResultCache::setLimit(qint64 limit)
+{
+    QMutexLocker locker(&mutex);
+    maxsize = limit;
+    if (!path.isEmpty()) {
+        evict();
+        dirty = true;
+    }
+}
+
+qint64
+ResultCache::size() const
+{
+    QMutexLocker locker(&mutex);
+    return total;
+}
+
+QString
+ResultCache::key(const QString& input, const QString& command, const QStringList& arguments, const QString& startin, const QString& output) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(QByteArray("jobman-cache-1\n"));
+    // tool identity, a rebuilt or upgraded binary gets new keys
+    struct stat tool;
+    if (::stat(QFile::encodeName(command).constData(), &tool) != 0) {
+        return QString();
+    }
+    hash.addData(QString("%1\n%2 %3 %4 %5\n")
+                 .arg(command)
+                 .arg(tool.st_dev)
+                 .arg(tool.st_ino)
+                 .arg(tool.st_size)
+                 .arg(QFileInfo(command).lastModified().toMSecsSinceEpoch())
+                 .toUtf8());
+    // outputs are restored into the current output directory, keep it out of the key
+    QString outputdir = QDir::cleanPath(output);
+    for (QString argument : arguments) {
+        argument.replace(outputdir, "%outputdir%");
+        hash.addData(argument.toUtf8());
+        hash.addData(QByteArray(1, '\0'));
+    }
+    hash.addData(QString(startin).replace(outputdir, "%outputdir%").toUtf8());
+    hash.addData(QByteArray("\n"));
+    QFile file(input);
+    if (!file.open(QIODevice::ReadOnly) || !hash.addData(&file)) {
+        return QString();
+    }
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+bool
+ResultCache::restore(const QString& key, const QString& output, QStringList* files)
+{
+    QMutexLocker locker(&mutex);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return false;
+    }
+    QDir objects(objectDir(key));
+    for (const Object& object : it->objects) {
+        QFileInfo info(objects.filePath(object.name));
+        if (!info.isFile() || info.size() != object.size || info.lastModified().toMSecsSinceEpoch() != object.modified) {
+            drop(key); // changed through a hardlinked output
+            return false;
+        }
+    }
+    QDir outputdir(output);
+    QStringList restored;
+    for (const Object& object : it->objects) {
+        QString target = outputdir.filePath(object.name);
+        if (!clone(objects.filePath(object.name), target, true)) {
+            return false;
+        }
+        restored.append(target);
+    }
+    it->used = QDateTime::currentMSecsSinceEpoch();
+    dirty = true;
+    if (files) {
+        *files = restored;
+    }
+    return true;
+}
+
+bool
+ResultCache::store(const QString& key, const QString& output, const QStringList& files)
+{
+    QMutexLocker locker(&mutex);
+    if (key.isEmpty() || files.isEmpty() || path.isEmpty()) {
+        return false;
+    }
+    drop(key);
+    QString dir = objectDir(key);
+    QString temporary = dir + ".tmp";
+    QDir(temporary).removeRecursively();
+    QDir().mkpath(temporary);
+    Entry entry { {}, 0, QDateTime::currentMSecsSinceEpoch() };
+    QDir outputdir(output);
+    for (const QString& file : files) {
+        QString name = outputdir.relativeFilePath(file);
+        QString target = QDir(temporary).filePath(name);
+        if (name.contains('/') || !clone(file, target, false)) { // a copy, never a link to the output
+            QDir(temporary).removeRecursively();
+            return false;
+        }
+        QFileInfo info(target);
+        entry.objects.append(Object { name, info.size(), info.lastModified().toMSecsSinceEpoch() });
+        entry.size += info.size();
+    }
+    if (entry.size > maxsize || ::rename(QFile::encodeName(temporary).constData(), QFile::encodeName(dir).constData()) != 0) {
+        QDir(temporary).removeRecursively();
+        return false;
+    }
+    entries.insert(key, entry);
+    total += entry.size;
+    evict();
+    dirty = true;
+    return true;
+}
+
+bool
+ResultCache::flush()
+{
+    QMutexLocker locker(&mutex);
+    if (!dirty || path.isEmpty()) {
+        return true;
+    }
+    dirty = !save();
+    return !dirty;
+}
+
+bool
+ResultCache::clone(const QString& source, const QString& target, bool hardlink) const
+{
+    // clone to a temporary name and rename over the target, readers never see a partial file
+    QString temporary = target + ".jobman";
+    QByteArray from = QFile::encodeName(source);
+    QByteArray to = QFile::encodeName(temporary);
+    ::unlink(to.constData());
+#if defined(Q_OS_MACOS)
+    bool cloned = clonefile(from.constData(), to.constData(), 0) == 0;
+#else
+    bool cloned = false;
+    int sourcefd = ::open(from.constData(), O_RDONLY | O_CLOEXEC);
+    if (sourcefd != -1) {
+        int targetfd = ::open(to.constData(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (targetfd != -1) {
+            cloned = ioctl(targetfd, FICLONE, sourcefd) == 0;
+            ::close(targetfd);
+            if (!cloned) {
+                ::unlink(to.constData());
+            }
+        }
+        ::close(sourcefd);
+    }
+#endif
+    if (!cloned && hardlink) {
+        cloned = ::link(from.constData(), to.constData()) == 0;
+    }
+    if (!cloned) {
+        cloned = QFile::copy(source, temporary);
+    }
+    if (!cloned || ::rename(to.constData(), QFile::encodeName(target).constData()) != 0) {
+        ::unlink(to.constData());
+        return false;
+    }
+    return true;
+}
+
+void
+ResultCache::drop(const QString& key)
+{
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        total -= it->size;
+        entries.erase(it);
+        dirty = true;
+    }
+    QDir(objectDir(key)).removeRecursively();
+}
+
+void
+ResultCache::evict()
+{
+    if (total <= maxsize) {
+        return;
+    }
+    QList<QPair<qint64, QString>> lru;
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        lru.append(qMakePair(it->used, it.key()));
+    }
+    std::sort(lru.begin(), lru.end());
+    for (const auto& entry : lru) {
+        if (total <= maxsize) {
+            break;
+        }
+        drop(entry.second);
+    }
+}
+
+bool
+ResultCache::save()
+{
+    QJsonObject json;
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        QJsonArray jsonobjects;
+        for (const Object& object : it->objects) {
+            QJsonObject jsonobject;
+            jsonobject["name"] = object.name;
+            jsonobject["size"] = static_cast<double>(object.size);
+            jsonobject["modified"] = static_cast<double>(object.modified);
+            jsonobjects.append(jsonobject);
+        }
+        QJsonObject jsonentry;
+        jsonentry["objects"] = jsonobjects;
+        jsonentry["used"] = static_cast<double>(it->used);
+        json[it.key()] = jsonentry;
+    }
+    QSaveFile index(indexFile());
+    if (!index.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    index.write(QJsonDocument(json).toJson(QJsonDocument::Compact));
+    return index.commit();
+}
+
+QString
+ResultCache::objectDir(const QString& key) const
+{
+    return QDir(path).filePath("objects/" + key);
+}
+
+QString
+ResultCache::indexFile() const
+{
+    return QDir(path).filePath("index");
+}
@@ -0,0 +1,49 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+class ResultCache
+{
+    public:
+        ResultCache();
+        ~ResultCache();
+        bool open(const QString& path);
+        qint64 limit() const;
+        void setLimit(qint64 limit);
+        qint64 size() const;
+        QString key(const QString& input, const QString& command, const QStringList& arguments, const QString& startin, const QString& output) const;
+        bool restore(const QString& key, const QString& output, QStringList* files);
+        bool store(const QString& key, const QString& output, const QStringList& files);
+        bool flush();
+
+    private:
+        struct Object {
+            QString name;
+            qint64 size;
+            qint64 modified;
+        };
+        struct Entry {
+            QList<Object> objects;
+            qint64 size;
+            qint64 used;
+        };
+        bool clone(const QString& source, const QString& target, bool hardlink) const;
+        void drop(const QString& key);
+        void evict();
+        bool save();
+        QString objectDir(const QString& key) const;
+        QString indexFile() const;
+        QString path;
+        QHash<QString, Entry> entries;
+        qint64 total;
+        qint64 maxsize;
+        bool dirty; // index changed since it was last written
+        mutable QMutex mutex;
+};
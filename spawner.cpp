@@ -0,0 +1,328 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "spawner.h"
+#include "spawnhelper.h"
+#include "supervisor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+#include <QDebug>
+
+extern char** environ;
+
+QScopedPointer<Spawner, Spawner::Deleter> Spawner::pi;
+
+class SpawnerPrivate : public QObject
+{
+    Q_OBJECT
+    public:
+        SpawnerPrivate();
+        ~SpawnerPrivate();
+        bool start(const QString& program);
+        void stop();
+        void run();
+        int spawn(const QByteArray& path, const QList<QByteArray>& arguments, const QByteArray& startin, int outputfd, int errorfd, int* error);
+        static void append(QByteArray& payload, quint32 value);
+        static void append(QByteArray& payload, const QByteArray& value);
+
+    public:
+        int socket;
+        pid_t helper;
+        bool running;
+        bool enabled;
+        qint32 sequence;
+        QHash<qint32, spawnhelper::Reply> replies;
+        mutable QMutex mutex;
+        QMutex writemutex;
+        QWaitCondition condition;
+        QScopedPointer<QThread> thread;
+};
+
+SpawnerPrivate::SpawnerPrivate()
+: socket(-1)
+, helper(-1)
+, running(false)
+, enabled(true)
+, sequence(0)
+{
+}
+
+SpawnerPrivate::~SpawnerPrivate()
+{
+    stop();
+}
+
+bool
+SpawnerPrivate::start(const QString& program)
+{
+    if (running) {
+        return true;
+    }
+    if (!QFileInfo(program).isExecutable()) {
+        qWarning() << "Spawn helper could not be found:" << program;
+        return false;
+    }
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1) {
+        qWarning() << "Spawn helper socket could not be created:" << strerror(errno);
+        return false;
+    }
+    fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sockets[1], F_SETFD, FD_CLOEXEC);
+#if defined(SO_NOSIGPIPE)
+    int on = 1;
+    setsockopt(sockets[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, sockets[1], spawnhelper::Descriptor);
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+#if defined(POSIX_SPAWN_CLOEXEC_DEFAULT)
+    posix_spawnattr_setflags(&attributes, POSIX_SPAWN_CLOEXEC_DEFAULT); // only inherit stdio and the socket
+#endif
+    QByteArray path = program.toLocal8Bit();
+    QByteArray descriptor = QByteArray::number(spawnhelper::Descriptor);
+    char* argv[] = { path.data(), descriptor.data(), nullptr };
+    int status = posix_spawn(&helper, path.constData(), &actions, &attributes, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    ::close(sockets[1]);
+    if (status != 0) {
+        qWarning() << "Spawn helper could not be started:" << strerror(status);
+        ::close(sockets[0]);
+        helper = -1;
+        return false;
+    }
+    socket = sockets[0];
+    running = true;
+    thread.reset(QThread::create([this]() { run(); }));
+    thread->setObjectName("Spawner");
+    thread->start();
+    return true;
+}
+
+void
+SpawnerPrivate::stop()
+{
+    if (socket == -1) {
+        return;
+    }
+    ::shutdown(socket, SHUT_RDWR); // helper exits on end of file, reader thread follows
+    if (thread) {
+        thread->wait();
+        thread.reset();
+    }
+    ::close(socket);
+    socket = -1;
+}
+
+void
+SpawnerPrivate::run()
+{
+    while (true) {
+        spawnhelper::Reply reply;
+        char* bytes = reinterpret_cast<char*>(&reply);
+        size_t size = sizeof(reply);
+        while (size > 0) {
+            ssize_t count = ::read(socket, bytes, size);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                break;
+            }
+            bytes += count;
+            size -= count;
+        }
+        if (size > 0) {
+            break; // helper is gone
+        }
+        if (reply.type == spawnhelper::Spawned) {
+            QMutexLocker locker(&mutex);
+            replies.insert(reply.id, reply);
+            condition.wakeAll();
+        } else if (reply.type == spawnhelper::Exited) {
+            Supervisor::instance()->exited(reply.pid, reply.value);
+        }
+    }
+    {
+        QMutexLocker locker(&mutex);
+        running = false;
+        condition.wakeAll(); // pending spawns fall back to the direct path
+    }
+    int status;
+    waitpid(helper, &status, 0);
+    helper = -1;
+}
+
+void
+SpawnerPrivate::append(QByteArray& payload, quint32 value)
+{
+    payload.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void
+SpawnerPrivate::append(QByteArray& payload, const QByteArray& value)
+{
+    append(payload, static_cast<quint32>(value.size()));
+    payload.append(value);
+}
+
+int
+SpawnerPrivate::spawn(const QByteArray& path, const QList<QByteArray>& arguments, const QByteArray& startin, int outputfd, int errorfd, int* error)
+{
+    qint32 id;
+    {
+        QMutexLocker locker(&mutex);
+        if (!running) {
+            if (error) *error = ECONNREFUSED;
+            return -1;
+        }
+        id = ++sequence;
+    }
+    QByteArray payload;
+    append(payload, static_cast<quint32>(id));
+    append(payload, startin);
+    append(payload, static_cast<quint32>(arguments.size() + 1));
+    append(payload, path);
+    for (const QByteArray& argument : arguments) {
+        append(payload, argument);
+    }
+    append(payload, static_cast<quint32>(0)); // inherit the helper environment
+    QByteArray message;
+    append(message, static_cast<quint32>(payload.size()));
+    message.append(payload);
+
+    int descriptors[2] = { outputfd, errorfd };
+    char control[CMSG_SPACE(sizeof(descriptors))];
+    memset(control, 0, sizeof(control));
+    struct iovec vector = { message.data(), static_cast<size_t>(message.size()) };
+    struct msghdr header = {};
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    struct cmsghdr* rights = CMSG_FIRSTHDR(&header);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(sizeof(descriptors));
+    memcpy(CMSG_DATA(rights), descriptors, sizeof(descriptors));
+    {
+        QMutexLocker locker(&writemutex);
+        ssize_t count;
+        do {
+#if defined(MSG_NOSIGNAL)
+            count = sendmsg(socket, &header, MSG_NOSIGNAL);
+#else
+            count = sendmsg(socket, &header, 0);
+#endif
+        } while (count < 0 && errno == EINTR);
+        // descriptors travel with the first chunk, send the rest as plain data
+        const char* rest = message.constData() + qMax<ssize_t>(count, 0);
+        size_t remaining = (count < 0) ? 0 : message.size() - count;
+        while (count >= 0 && remaining > 0) {
+            ssize_t written = ::write(socket, rest, remaining);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                count = -1;
+                break;
+            }
+            rest += written;
+            remaining -= written;
+        }
+        if (count < 0) {
+            if (error) *error = errno;
+            return -1;
+        }
+    }
+    QMutexLocker locker(&mutex);
+    while (running && !replies.contains(id)) {
+        condition.wait(&mutex);
+    }
+    if (!replies.contains(id)) {
+        if (error) *error = ECONNRESET;
+        return -1;
+    }
+    spawnhelper::Reply reply = replies.take(id);
+    if (error) *error = reply.value;
+    return reply.pid;
+}
+
+#include "spawner.moc"
+
+Spawner::Spawner()
+: p(new SpawnerPrivate())
+{
+}
+
+Spawner::~Spawner()
+{
+}
+
+Spawner*
+Spawner::instance()
+{
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    if (!pi) {
+        pi.reset(new Spawner());
+    }
+    return pi.data();
+}
+
+bool
+Spawner::start(const QString& program)
+{
+    return p->start(program);
+}
+
+void
+Spawner::stop()
+{
+    p->stop();
+}
+
+bool
+Spawner::isRunning() const
+{
+    QMutexLocker locker(&p->mutex);
+    return p->running;
+}
+
+bool
+Spawner::isEnabled() const
+{
+    QMutexLocker locker(&p->mutex);
+    return p->enabled;
+}
+
+void
+Spawner::setEnabled(bool enabled)
+{
+    QMutexLocker locker(&p->mutex);
+    p->enabled = enabled;
+}
+
+int
+Spawner::spawn(const QByteArray& path, const QList<QByteArray>& arguments, const QByteArray& startin, int outputfd, int errorfd, int* error)
+{
+    return p->spawn(path, arguments, startin, outputfd, errorfd, error);
+}
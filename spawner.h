@@ -0,0 +1,42 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include <QList>
+#include <QObject>
+#include <QScopedPointer>
+
+class SpawnerPrivate;
+class Spawner : public QObject
+{
+    Q_OBJECT
+    public:
+        static Spawner* instance();
+        bool start(const QString& program);
+        void stop();
+        bool isRunning() const;
+        bool isEnabled() const;
+        void setEnabled(bool enabled);
+        int spawn(const QByteArray& path,
+                  const QList<QByteArray>& arguments,
+                  const QByteArray& startin,
+                  int outputfd,
+                  int errorfd,
+                  int* error = nullptr);
+
+    private:
+        Spawner();
+        ~Spawner();
+        Spawner(const Spawner&) = delete;
+        Spawner& operator=(const Spawner&) = delete;
+        class Deleter {
+        public:
+            static void cleanup(Spawner* pointer) {
+                delete pointer;
+            }
+        };
+        static QScopedPointer<Spawner, Deleter> pi;
+        QScopedPointer<SpawnerPrivate> p;
+};
@@ -0,0 +1,291 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "spawnhelper.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <vector>
+
+// small helper started by jobman at launch, children are forked from this
+// tiny image instead of the large application and get their own working
+// directory without touching the application's
+
+extern char** environ;
+
+namespace
+{
+    int signalpipe[2] = { -1, -1 };
+
+    void
+    childSignal(int)
+    {
+        int saved = errno;
+        char byte = 0;
+        ssize_t written = write(signalpipe[1], &byte, 1);
+        (void)written;
+        errno = saved;
+    }
+
+    bool
+    readFully(int fd, void* data, size_t size)
+    {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t count = read(fd, bytes, size);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            bytes += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    bool
+    writeFully(int fd, const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t count = write(fd, bytes, size);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            bytes += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    bool
+    reply(int socket, int32_t type, int32_t id, int32_t pid, int32_t value)
+    {
+        spawnhelper::Reply message { type, id, pid, value };
+        return writeFully(socket, &message, sizeof(message));
+    }
+
+    class Reader {
+        public:
+            Reader(const std::vector<char>& data)
+            : data(data)
+            , offset(0)
+            , valid(true)
+            {
+            }
+            uint32_t number() {
+                uint32_t value = 0;
+                if (offset + sizeof(value) > data.size()) {
+                    valid = false;
+                    return 0;
+                }
+                memcpy(&value, data.data() + offset, sizeof(value));
+                offset += sizeof(value);
+                return value;
+            }
+            std::string string() {
+                uint32_t length = number();
+                if (!valid || offset + length > data.size()) {
+                    valid = false;
+                    return std::string();
+                }
+                std::string value(data.data() + offset, length);
+                offset += length;
+                return value;
+            }
+            const std::vector<char>& data;
+            size_t offset;
+            bool valid;
+    };
+
+    bool
+    receive(int socket, std::vector<char>& payload, int descriptors[2])
+    {
+        uint32_t size = 0;
+        char control[CMSG_SPACE(sizeof(int) * 2)];
+        struct iovec vector = { &size, sizeof(size) };
+        struct msghdr message = {};
+        message.msg_iov = &vector;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t count;
+        do {
+            count = recvmsg(socket, &message, MSG_WAITALL);
+        } while (count < 0 && errno == EINTR);
+        if (count != sizeof(size)) {
+            return false;
+        }
+        descriptors[0] = descriptors[1] = -1;
+        for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+                memcpy(descriptors, CMSG_DATA(header), sizeof(int) * 2);
+            }
+        }
+        payload.resize(size);
+        return readFully(socket, payload.data(), size);
+    }
+
+    void
+    spawn(int socket, const std::vector<char>& payload, int descriptors[2])
+    {
+        Reader reader(payload);
+        int32_t id = static_cast<int32_t>(reader.number());
+        std::string cwd = reader.string();
+        std::vector<std::string> arguments(reader.number());
+        for (std::string& argument : arguments) {
+            argument = reader.string();
+        }
+        std::vector<std::string> environment(reader.number());
+        for (std::string& variable : environment) {
+            variable = reader.string();
+        }
+        if (!reader.valid || arguments.empty() || descriptors[0] == -1 || descriptors[1] == -1) {
+            for (int i = 0; i < 2; ++i) {
+                if (descriptors[i] != -1) close(descriptors[i]);
+            }
+            reply(socket, spawnhelper::Spawned, id, -1, EINVAL);
+            return;
+        }
+        std::vector<char*> argv;
+        for (std::string& argument : arguments) {
+            argv.push_back(&argument[0]);
+        }
+        argv.push_back(nullptr);
+        std::vector<char*> envp;
+        for (std::string& variable : environment) {
+            envp.push_back(&variable[0]);
+        }
+        envp.push_back(nullptr);
+        char** env = environment.empty() ? environ : envp.data();
+
+        int errorpipe[2];
+        if (pipe(errorpipe) == -1) {
+            close(descriptors[0]);
+            close(descriptors[1]);
+            reply(socket, spawnhelper::Spawned, id, -1, errno);
+            return;
+        }
+        for (int fd : { errorpipe[0], errorpipe[1], descriptors[0], descriptors[1] }) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            signal(SIGCHLD, SIG_DFL);
+            signal(SIGPIPE, SIG_DFL);
+            sigset_t mask;
+            sigemptyset(&mask);
+            sigprocmask(SIG_SETMASK, &mask, nullptr);
+            setpgid(0, 0); // own process group, signals reach the whole tool
+            dup2(descriptors[0], STDOUT_FILENO);
+            dup2(descriptors[1], STDERR_FILENO);
+            if (cwd.empty() || chdir(cwd.c_str()) == 0) {
+                execve(argv[0], argv.data(), env);
+            }
+            int error = errno;
+            ssize_t written = write(errorpipe[1], &error, sizeof(error));
+            (void)written;
+            _exit(127);
+        }
+        int error = (pid == -1) ? errno : 0;
+        close(errorpipe[1]);
+        close(descriptors[0]);
+        close(descriptors[1]);
+        if (pid > 0) {
+            // the pipe closes on exec, data means exec or chdir failed
+            ssize_t count;
+            do {
+                count = read(errorpipe[0], &error, sizeof(error));
+            } while (count < 0 && errno == EINTR);
+            if (count == sizeof(error)) {
+                int status;
+                waitpid(pid, &status, 0);
+                pid = -1;
+            } else {
+                error = 0;
+            }
+        }
+        close(errorpipe[0]);
+        reply(socket, spawnhelper::Spawned, id, pid, error);
+    }
+
+    bool
+    reap(int socket)
+    {
+        while (true) {
+            int status = 0;
+            pid_t pid = waitpid(-1, &status, WNOHANG);
+            if (pid <= 0) {
+                return true;
+            }
+            if (!reply(socket, spawnhelper::Exited, 0, pid, status)) {
+                return false;
+            }
+        }
+    }
+}
+
+int
+main(int argc, char* argv[])
+{
+    int socket = (argc > 1) ? atoi(argv[1]) : spawnhelper::Descriptor;
+    if (pipe(signalpipe) == -1) {
+        return 1;
+    }
+    for (int fd : signalpipe) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    fcntl(socket, F_SETFD, FD_CLOEXEC);
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction action = {};
+    action.sa_handler = childSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &action, nullptr);
+
+    std::vector<char> payload;
+    while (true) {
+        struct pollfd fds[2] = {
+            { socket, POLLIN, 0 },
+            { signalpipe[0], POLLIN, 0 }
+        };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            char bytes[64];
+            while (read(signalpipe[0], bytes, sizeof(bytes)) > 0) {}
+            if (!reap(socket)) {
+                break;
+            }
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            int descriptors[2];
+            if (!receive(socket, payload, descriptors)) {
+                break; // jobman went away
+            }
+            spawn(socket, payload, descriptors);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include <stdint.h>
+
+// wire format shared by the spawn helper and Spawner, requests are a
+// uint32 payload size followed by the payload, with the stdout and stderr
+// descriptors attached as SCM_RIGHTS. strings are a uint32 length and bytes
+//
+// payload: id, cwd, argc, argv[argc], envc, env[envc]
+
+namespace spawnhelper
+{
+    enum Type {
+        Spawned = 1,
+        Exited = 2
+    };
+    struct Reply {
+        int32_t type;
+        int32_t id;
+        int32_t pid;
+        int32_t value; // errno for spawned, wait status for exited
+    };
+    const int Descriptor = 3; // socket descriptor inherited by the helper
+}
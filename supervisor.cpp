@@ -0,0 +1,404 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "supervisor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#if defined(Q_OS_MACOS)
+#include <sys/event.h>
+#else
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#endif
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QThread>
+#include <QDebug>
+
+QScopedPointer<Supervisor, Supervisor::Deleter> Supervisor::pi;
+
+class SupervisorPrivate : public QObject
+{
+    Q_OBJECT
+    public:
+        struct Child {
+            int pid;
+            int pidfd;
+            int outputfd;
+            int errorfd;
+            bool external;
+            Supervisor::Client* client;
+        };
+        SupervisorPrivate();
+        ~SupervisorPrivate();
+        void init();
+        void watch(int pid, int outputfd, int errorfd, Supervisor::Client* client, bool external);
+        void unwatch(Supervisor::Client* client);
+        void exited(int pid, int status);
+        void run();
+        bool addRead(int fd);
+        bool addExit(Child& child);
+        void closeRead(Child& child, int fd);
+        void read(Child& child, int fd, int chunks);
+        void reap(int pid, bool block);
+        void finish(Child& child, int status);
+
+    public:
+        enum {
+            Chunks = 16 // reads per wakeup, keeps busy pipes from starving others
+        };
+        int queue;
+        int wakeup[2];
+        bool running;
+        mutable QMutex mutex;
+        QHash<int, Child> children;
+        QHash<int, int> descriptors;
+        QSet<int> polled;
+        QHash<int, int> exits;
+        QScopedPointer<QThread> thread;
+        char buffer[65536];
+};
+
+SupervisorPrivate::SupervisorPrivate()
+: queue(-1)
+, running(false)
+{
+    wakeup[0] = wakeup[1] = -1;
+}
+
+SupervisorPrivate::~SupervisorPrivate()
+{
+    if (thread) {
+        {
+            QMutexLocker locker(&mutex);
+            running = false;
+        }
+        char byte = 0;
+        ::write(wakeup[1], &byte, 1);
+        thread->wait();
+    }
+    for (Child& child : children) {
+        if (child.outputfd != -1) ::close(child.outputfd);
+        if (child.errorfd != -1) ::close(child.errorfd);
+        if (child.pidfd != -1) ::close(child.pidfd);
+    }
+    if (wakeup[0] != -1) ::close(wakeup[0]);
+    if (wakeup[1] != -1) ::close(wakeup[1]);
+    if (queue != -1) ::close(queue);
+}
+
+void
+SupervisorPrivate::init()
+{
+#if defined(Q_OS_MACOS)
+    queue = kqueue();
+#else
+    queue = epoll_create1(EPOLL_CLOEXEC);
+#endif
+    if (queue == -1 || pipe(wakeup) == -1) {
+        qWarning() << "Supervisor could not create event queue:" << strerror(errno);
+        return;
+    }
+    for (int fd : wakeup) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    addRead(wakeup[0]);
+    running = true;
+    thread.reset(QThread::create([this]() { run(); }));
+    thread->setObjectName("Supervisor");
+    thread->start();
+}
+
+void
+SupervisorPrivate::watch(int pid, int outputfd, int errorfd, Supervisor::Client* client, bool external)
+{
+    QMutexLocker locker(&mutex);
+    Child child { pid, -1, outputfd, errorfd, external, client };
+    for (int fd : { outputfd, errorfd }) {
+        if (fd != -1) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            descriptors.insert(fd, pid);
+            addRead(fd);
+        }
+    }
+    if (external) {
+        if (exits.contains(pid)) {
+            char byte = 0; // exit arrived before the watch
+            ::write(wakeup[1], &byte, 1);
+        }
+    } else if (!addExit(child)) {
+        polled.insert(pid); // no exit notification, fall back to polling
+        char byte = 0;
+        ::write(wakeup[1], &byte, 1);
+    }
+    children.insert(pid, child);
+}
+
+void
+SupervisorPrivate::exited(int pid, int status)
+{
+    // reaped by another process, finish from the supervisor thread
+    QMutexLocker locker(&mutex);
+    exits.insert(pid, status);
+    char byte = 0;
+    ::write(wakeup[1], &byte, 1);
+}
+
+void
+SupervisorPrivate::unwatch(Supervisor::Client* client)
+{
+    QMutexLocker locker(&mutex); // waits for callbacks in progress
+    for (Child& child : children) {
+        if (child.client == client) {
+            child.client = nullptr; // keep watching, the child still needs to be reaped
+        }
+    }
+}
+
+bool
+SupervisorPrivate::addRead(int fd)
+{
+#if defined(Q_OS_MACOS)
+    struct kevent event;
+    EV_SET(&event, fd, EVFILT_READ, EV_ADD, 0, 0, nullptr);
+    return kevent(queue, &event, 1, nullptr, 0, nullptr) == 0;
+#else
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    return epoll_ctl(queue, EPOLL_CTL_ADD, fd, &event) == 0;
+#endif
+}
+
+bool
+SupervisorPrivate::addExit(Child& child)
+{
+#if defined(Q_OS_MACOS)
+    struct kevent event;
+    EV_SET(&event, child.pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, nullptr);
+    return kevent(queue, &event, 1, nullptr, 0, nullptr) == 0;
+#else
+#if defined(SYS_pidfd_open)
+    child.pidfd = static_cast<int>(syscall(SYS_pidfd_open, child.pid, 0));
+#endif
+    if (child.pidfd == -1) {
+        return false;
+    }
+    fcntl(child.pidfd, F_SETFD, FD_CLOEXEC);
+    descriptors.insert(child.pidfd, child.pid);
+    return addRead(child.pidfd);
+#endif
+}
+
+void
+SupervisorPrivate::closeRead(Child& child, int fd)
+{
+    descriptors.remove(fd);
+    ::close(fd); // also removes the descriptor from the event queue
+    if (child.outputfd == fd) child.outputfd = -1;
+    if (child.errorfd == fd) child.errorfd = -1;
+}
+
+void
+SupervisorPrivate::read(Child& child, int fd, int chunks)
+{
+    Supervisor::Channel channel = (fd == child.outputfd) ? Supervisor::Output : Supervisor::Error;
+    while (chunks-- > 0) {
+        ssize_t bytes = ::read(fd, buffer, sizeof(buffer));
+        if (bytes > 0) {
+            if (child.client) {
+                child.client->readyRead(channel, buffer, bytes);
+            }
+        } else if (bytes < 0 && errno == EINTR) {
+            continue;
+        } else if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        } else {
+            closeRead(child, fd); // end of file or read error
+            return;
+        }
+    }
+}
+
+void
+SupervisorPrivate::reap(int pid, bool block)
+{
+    auto it = children.find(pid);
+    if (it == children.end()) {
+        return;
+    }
+    int status = 0;
+    pid_t result;
+    do {
+        result = waitpid(pid, &status, block ? 0 : WNOHANG);
+    } while (result == -1 && errno == EINTR);
+    if (result == 0) {
+        return; // still running
+    }
+    if (result == -1) {
+        status = W_EXITCODE(127, 0); // already reaped elsewhere, report as failed
+    }
+    finish(it.value(), status);
+    children.erase(it);
+    polled.remove(pid);
+}
+
+void
+SupervisorPrivate::finish(Child& child, int status)
+{
+    // drain what the child left in the pipes, but don't wait for
+    // grandchildren that may have inherited the write ends
+    for (int fd : { child.outputfd, child.errorfd }) {
+        if (fd != -1) {
+            read(child, fd, Chunks * 4);
+            if (fd == child.outputfd || fd == child.errorfd) {
+                closeRead(child, fd);
+            }
+        }
+    }
+    if (child.pidfd != -1) {
+        descriptors.remove(child.pidfd);
+        ::close(child.pidfd);
+        child.pidfd = -1;
+    }
+    if (child.client) {
+        child.client->finished(status);
+    }
+}
+
+void
+SupervisorPrivate::run()
+{
+    const int maxevents = 64;
+    while (true) {
+        int timeout = -1;
+        {
+            QMutexLocker locker(&mutex);
+            if (!running) {
+                break;
+            }
+            if (!polled.isEmpty()) {
+                timeout = 100;
+            }
+        }
+#if defined(Q_OS_MACOS)
+        struct kevent events[maxevents];
+        struct timespec interval = { 0, timeout * 1000000L };
+        int count = kevent(queue, nullptr, 0, events, maxevents, timeout < 0 ? nullptr : &interval);
+#else
+        struct epoll_event events[maxevents];
+        int count = epoll_wait(queue, events, maxevents, timeout);
+#endif
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            qWarning() << "Supervisor event queue failed:" << strerror(errno);
+            break;
+        }
+        QMutexLocker locker(&mutex);
+        for (int i = 0; i < count; ++i) {
+#if defined(Q_OS_MACOS)
+            int ident = static_cast<int>(events[i].ident);
+            if (events[i].filter == EVFILT_PROC) {
+                reap(ident, true);
+                continue;
+            }
+            int fd = ident;
+#else
+            int fd = events[i].data.fd;
+#endif
+            if (fd == wakeup[0]) {
+                char bytes[64];
+                while (::read(fd, bytes, sizeof(bytes)) > 0) {}
+                continue;
+            }
+            auto descriptor = descriptors.constFind(fd);
+            if (descriptor == descriptors.constEnd()) {
+                continue; // closed earlier in this batch
+            }
+            int pid = descriptor.value();
+            auto it = children.find(pid);
+            if (it == children.end()) {
+                continue;
+            }
+            if (fd == it->pidfd) {
+                reap(pid, true);
+            } else {
+                read(it.value(), fd, Chunks);
+            }
+        }
+        const QList<int> pids = polled.values();
+        for (int pid : pids) {
+            reap(pid, false);
+        }
+        for (auto entry = exits.begin(); entry != exits.end();) {
+            auto it = children.find(entry.key());
+            if (it == children.end()) {
+                ++entry; // not watched yet
+                continue;
+            }
+            finish(it.value(), entry.value());
+            children.erase(it);
+            entry = exits.erase(entry);
+        }
+    }
+}
+
+#include "supervisor.moc"
+
+Supervisor::Supervisor()
+: p(new SupervisorPrivate())
+{
+    p->init();
+}
+
+Supervisor::~Supervisor()
+{
+}
+
+Supervisor*
+Supervisor::instance()
+{
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    if (!pi) {
+        pi.reset(new Supervisor());
+    }
+    return pi.data();
+}
+
+void
+Supervisor::watch(int pid, int outputfd, int errorfd, Client* client, bool external)
+{
+    p->watch(pid, outputfd, errorfd, client, external);
+}
+
+void
+Supervisor::exited(int pid, int status)
+{
+    p->exited(pid, status);
+}
+
+void
+Supervisor::unwatch(Client* client)
+{
+    p->unwatch(client);
+}
+
+int
+Supervisor::count() const
+{
+    QMutexLocker locker(&p->mutex);
+    return p->children.size();
+}
@@ -0,0 +1,48 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include <QObject>
+#include <QScopedPointer>
+
+class SupervisorPrivate;
+class Supervisor : public QObject
+{
+    Q_OBJECT
+    public:
+        enum Channel {
+            Output,
+            Error
+        };
+        Q_ENUM(Channel)
+
+        class Client {
+            public:
+                virtual ~Client() = default;
+                virtual void readyRead(Channel channel, const char* data, qint64 size) = 0;
+                virtual void finished(int status) = 0;
+        };
+
+    public:
+        static Supervisor* instance();
+        void watch(int pid, int outputfd, int errorfd, Client* client, bool external = false);
+        void exited(int pid, int status);
+        void unwatch(Client* client);
+        int count() const;
+
+    private:
+        Supervisor();
+        ~Supervisor();
+        Supervisor(const Supervisor&) = delete;
+        Supervisor& operator=(const Supervisor&) = delete;
+        class Deleter {
+        public:
+            static void cleanup(Supervisor* pointer) {
+                delete pointer;
+            }
+        };
+        static QScopedPointer<Supervisor, Deleter> pi;
+        QScopedPointer<SupervisorPrivate> p;
+};
@@ -0,0 +1,242 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "trace.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QSet>
+#include <QDebug>
+
+// job timelines in a fixed ring of small events, recording is a lock and a
+// store so it can stay on. names are kept once per job and the chrome trace
+// event json is only built on export: one track per slot with a run slice
+// per attempt, a nested spawn slice, async wait spans and flow arrows from a
+// parent's run to the dependents it released
+
+Trace::Trace()
+: next(0)
+, wrapped(false)
+, ids(0)
+{
+    events.resize(Capacity);
+    clock.start();
+}
+
+void
+Trace::describe(const QUuid& uuid, const QString& name, const QString& filename, const QUuid& dependson)
+{
+    QMutexLocker locker(&mutex);
+    quint32 job = ++ids; // 0 is no job
+    jobs.insert(uuid, job);
+    infos.insert(job, Info { name, filename, dependson });
+}
+
+void
+Trace::forget(const QUuid& uuid)
+{
+    QMutexLocker locker(&mutex);
+    quint32 job = jobs.take(uuid);
+    infos.remove(job);
+    auto it = slots.find(job);
+    if (it != slots.end()) { // removed while running
+        busy[it.value()] = false;
+        slots.erase(it);
+    }
+}
+
+void
+Trace::ready(const QUuid& uuid)
+{
+    record(Ready, uuid);
+}
+
+void
+Trace::dispatch(const QUuid& uuid)
+{
+    record(Dispatch, uuid);
+}
+
+void
+Trace::begin(const QUuid& uuid)
+{
+    record(Begin, uuid);
+}
+
+void
+Trace::spawned(const QUuid& uuid)
+{
+    record(Spawned, uuid);
+}
+
+void
+Trace::end(const QUuid& uuid, int status)
+{
+    record(End, uuid, status);
+}
+
+void
+Trace::release(const QUuid& uuid)
+{
+    record(Release, uuid);
+}
+
+void
+Trace::record(Type type, const QUuid& uuid, int status)
+{
+    qint64 time = clock.nsecsElapsed();
+    QMutexLocker locker(&mutex);
+    quint32 job = jobs.value(uuid, 0);
+    if (!job) {
+        return; // removed
+    }
+    int slot = -1;
+    if (type == Dispatch) { // lowest free slot, tracks stay dense
+        slot = busy.indexOf(false);
+        if (slot == -1) {
+            slot = busy.size();
+            busy.append(true);
+        }
+        busy[slot] = true;
+        slots.insert(job, slot);
+    } else if (type == End) {
+        slot = slots.value(job, -1);
+        if (slot != -1) {
+            busy[slot] = false;
+            slots.remove(job);
+        }
+    } else {
+        slot = slots.value(job, -1);
+    }
+    events[next] = Event { time, job, slot, static_cast<qint16>(type), static_cast<qint16>(status) };
+    if (++next == events.size()) {
+        next = 0;
+        wrapped = true;
+    }
+}
+
+QByteArray
+Trace::json() const
+{
+    QVector<Event> ordered;
+    QHash<quint32, Info> names;
+    QHash<QUuid, quint32> uuids;
+    {
+        QMutexLocker locker(&mutex);
+        if (wrapped) {
+            ordered = events.mid(next) + events.mid(0, next);
+        } else {
+            ordered = events.mid(0, next);
+        }
+        names = infos;
+        uuids = jobs;
+    }
+    auto micros = [](qint64 time) {
+        return time / 1000.0;
+    };
+    auto name = [&names](quint32 job) {
+        auto it = names.constFind(job);
+        return it != names.constEnd() ? it->name : QString("Job %1").arg(job);
+    };
+    auto parent = [&names, &uuids](quint32 job) {
+        return uuids.value(names.value(job).dependson, 0);
+    };
+    QJsonArray trace;
+    QHash<quint32, qint64> waiting;
+    QHash<quint32, qint64> begun;
+    QHash<quint32, QPair<qint64, int>> ended; // last run of each job, where flows start
+    QSet<int> tracks;
+    for (const Event& event : ordered) {
+        switch (event.type) {
+            case Ready: {
+                waiting.insert(event.job, event.time);
+            }
+            break;
+            case Dispatch: {
+                auto it = waiting.find(event.job);
+                if (it != waiting.end()) {
+                    QJsonObject start { { "ph", "b" }, { "cat", "wait" }, { "name", name(event.job) },
+                                        { "id", static_cast<qint64>(event.job) }, { "pid", 1 }, { "tid", 0 }, { "ts", micros(it.value()) } };
+                    QJsonObject finish { { "ph", "e" }, { "cat", "wait" }, { "name", name(event.job) },
+                                         { "id", static_cast<qint64>(event.job) }, { "pid", 1 }, { "tid", 0 }, { "ts", micros(event.time) } };
+                    trace.append(start);
+                    trace.append(finish);
+                    waiting.erase(it);
+                }
+            }
+            break;
+            case Begin: {
+                begun.insert(event.job, event.time);
+                auto flow = ended.constFind(parent(event.job));
+                if (flow != ended.constEnd() && event.slot != -1) {
+                    // arrow from the end of the parent's run to the start of this one
+                    QJsonObject start { { "ph", "s" }, { "cat", "dependson" }, { "name", "dependson" }, { "id", static_cast<qint64>(event.job) },
+                                        { "pid", 1 }, { "tid", flow->second + 1 }, { "ts", micros(flow->first) - 0.001 } };
+                    QJsonObject finish { { "ph", "f" }, { "bp", "e" }, { "cat", "dependson" }, { "name", "dependson" }, { "id", static_cast<qint64>(event.job) },
+                                         { "pid", 1 }, { "tid", event.slot + 1 }, { "ts", micros(event.time) } };
+                    trace.append(start);
+                    trace.append(finish);
+                }
+            }
+            break;
+            case Spawned: {
+                auto it = begun.constFind(event.job);
+                if (it != begun.constEnd() && event.slot != -1) {
+                    QJsonObject spawn { { "ph", "X" }, { "cat", "spawn" }, { "name", "spawn" }, { "pid", 1 }, { "tid", event.slot + 1 },
+                                        { "ts", micros(it.value()) }, { "dur", micros(event.time - it.value()) } };
+                    trace.append(spawn);
+                }
+            }
+            break;
+            case End: {
+                auto it = begun.find(event.job);
+                if (it != begun.end() && event.slot != -1) {
+                    const Info info = names.value(event.job);
+                    QJsonObject args { { "filename", info.filename }, { "status", event.status } };
+                    QJsonObject run { { "ph", "X" }, { "cat", "run" }, { "name", name(event.job) }, { "pid", 1 }, { "tid", event.slot + 1 },
+                                      { "ts", micros(it.value()) }, { "dur", micros(event.time - it.value()) }, { "args", args } };
+                    trace.append(run);
+                    tracks.insert(event.slot);
+                    ended.insert(event.job, qMakePair(event.time, event.slot));
+                    begun.erase(it);
+                }
+            }
+            break;
+            case Release: {
+                auto flow = ended.constFind(parent(event.job));
+                if (flow != ended.constEnd()) {
+                    QJsonObject release { { "ph", "i" }, { "s", "t" }, { "cat", "dependson" }, { "name", QString("release %1").arg(name(event.job)) },
+                                          { "pid", 1 }, { "tid", flow->second + 1 }, { "ts", micros(event.time) } };
+                    trace.append(release);
+                }
+            }
+            break;
+        }
+    }
+    // names for the process and each slot track, wait spans live on track 0
+    trace.append(QJsonObject { { "ph", "M" }, { "name", "process_name" }, { "pid", 1 }, { "args", QJsonObject { { "name", "Jobman" } } } });
+    trace.append(QJsonObject { { "ph", "M" }, { "name", "thread_name" }, { "pid", 1 }, { "tid", 0 }, { "args", QJsonObject { { "name", "Waiting" } } } });
+    for (int slot : tracks) {
+        trace.append(QJsonObject { { "ph", "M" }, { "name", "thread_name" }, { "pid", 1 }, { "tid", slot + 1 },
+                                   { "args", QJsonObject { { "name", QString("Slot %1").arg(slot + 1) } } } });
+        trace.append(QJsonObject { { "ph", "M" }, { "name", "thread_sort_index" }, { "pid", 1 }, { "tid", slot + 1 },
+                                   { "args", QJsonObject { { "sort_index", slot + 1 } } } });
+    }
+    QJsonObject json { { "traceEvents", trace }, { "displayTimeUnit", "ms" } };
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+bool
+Trace::write(const QString& filename) const
+{
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Could not write trace:" << filename;
+        return false;
+    }
+    file.write(json());
+    return file.commit();
+}
@@ -0,0 +1,65 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QUuid>
+#include <QVector>
+
+class Trace
+{
+    public:
+        enum {
+            Capacity = 262144 // events kept, older ones are overwritten
+        };
+        Trace();
+        void describe(const QUuid& uuid, const QString& name, const QString& filename, const QUuid& dependson);
+        void forget(const QUuid& uuid);
+        void ready(const QUuid& uuid);
+        void dispatch(const QUuid& uuid);
+        void begin(const QUuid& uuid);
+        void spawned(const QUuid& uuid);
+        void end(const QUuid& uuid, int status);
+        void release(const QUuid& uuid);
+        QByteArray json() const;
+        bool write(const QString& filename) const;
+
+    private:
+        enum Type {
+            Ready,
+            Dispatch,
+            Begin,
+            Spawned,
+            End,
+            Release
+        };
+        struct Event {
+            qint64 time; // ns on the trace clock
+            quint32 job;
+            qint32 slot;
+            qint16 type;
+            qint16 status;
+        };
+        struct Info {
+            QString name;
+            QString filename;
+            QUuid dependson;
+        };
+        void record(Type type, const QUuid& uuid, int status = 0);
+        QVector<Event> events;
+        int next;
+        bool wrapped;
+        quint32 ids;
+        QHash<QUuid, quint32> jobs;
+        QHash<quint32, Info> infos;
+        QHash<quint32, int> slots; // running jobs to the slot they occupy
+        QVector<bool> busy;
+        QElapsedTimer clock;
+        mutable QMutex mutex;
+};
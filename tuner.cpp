@@ -0,0 +1,261 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "tuner.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QPointer>
+#include <QTimer>
+#include <QDebug>
+
+#if defined(Q_OS_MACOS)
+#include <CoreFoundation/CoreFoundation.h>
+#include <IOKit/IOKitLib.h>
+#include <IOKit/storage/IOBlockStorageDriver.h>
+#include <mach/mach.h>
+#include <unistd.h>
+#endif
+
+// hill-climbing on completed jobs per second, a step is kept while throughput
+// improves and reversed when it drops. plateaus lean towards fewer threads and
+// a saturated cpu or high io wait always backs off
+
+class TunerPrivate : public QObject
+{
+    Q_OBJECT
+    public:
+        struct Load {
+            quint64 busy = 0;
+            quint64 iowait = 0;
+            quint64 total = 0;
+        };
+        TunerPrivate();
+        void init();
+        Load sample() const;
+        static quint64 diskTime();
+        void adjust();
+        void setThreads(int threads);
+
+    public:
+        enum {
+            Interval = 5000 // ms between adjustments
+        };
+        bool enabled;
+        int minimum;
+        int maximum;
+        int threads;
+        int direction;
+        int completed;
+        double throughput;
+        Load load;
+        QTimer timer;
+        QElapsedTimer elapsed;
+        QPointer<Tuner> tuner;
+};
+
+TunerPrivate::TunerPrivate()
+: enabled(false)
+, minimum(1)
+, maximum(1)
+, threads(1)
+, direction(1)
+, completed(0)
+, throughput(0)
+{
+}
+
+void
+TunerPrivate::init()
+{
+    timer.setInterval(Interval);
+    connect(&timer, &QTimer::timeout, this, &TunerPrivate::adjust);
+}
+
+TunerPrivate::Load
+TunerPrivate::sample() const
+{
+    Load sample;
+#if defined(Q_OS_MACOS)
+    host_cpu_load_info_data_t info;
+    mach_msg_type_number_t count = HOST_CPU_LOAD_INFO_COUNT;
+    if (host_statistics(mach_host_self(), HOST_CPU_LOAD_INFO, reinterpret_cast<host_info_t>(&info), &count) == KERN_SUCCESS) {
+        sample.busy = info.cpu_ticks[CPU_STATE_USER] + info.cpu_ticks[CPU_STATE_SYSTEM] + info.cpu_ticks[CPU_STATE_NICE];
+        sample.total = sample.busy + info.cpu_ticks[CPU_STATE_IDLE];
+        // no io wait state on macos, time spent on disk transfers stands in for
+        // it, in ticks of one cpu as a thread blocks on each outstanding transfer
+        sample.iowait = diskTime() * sysconf(_SC_CLK_TCK) / 1000000000ULL;
+    }
+#else
+    QFile file("/proc/stat");
+    if (file.open(QIODevice::ReadOnly)) {
+        // cpu user nice system idle iowait irq softirq steal
+        QList<QByteArray> fields = file.readLine().simplified().split(' ');
+        for (int i = 1; i < fields.size() && i <= 8; ++i) {
+            quint64 ticks = fields[i].toULongLong();
+            sample.total += ticks;
+            if (i == 5) {
+                sample.iowait = ticks;
+            } else if (i != 4) {
+                sample.busy += ticks;
+            }
+        }
+    }
+#endif
+    return sample;
+}
+
+quint64
+TunerPrivate::diskTime()
+{
+#if defined(Q_OS_MACOS)
+    // ns the block storage drivers spent on reads and writes since boot
+    quint64 time = 0;
+    io_iterator_t drivers;
+    if (IOServiceGetMatchingServices(MACH_PORT_NULL, IOServiceMatching(kIOBlockStorageDriverClass), &drivers) != KERN_SUCCESS) {
+        return 0;
+    }
+    io_registry_entry_t driver;
+    while ((driver = IOIteratorNext(drivers))) {
+        CFDictionaryRef statistics = static_cast<CFDictionaryRef>(
+            IORegistryEntryCreateCFProperty(driver, CFSTR(kIOBlockStorageDriverStatisticsKey), kCFAllocatorDefault, 0));
+        if (statistics) {
+            CFStringRef keys[] = { CFSTR(kIOBlockStorageDriverStatisticsTotalReadTimeKey), CFSTR(kIOBlockStorageDriverStatisticsTotalWriteTimeKey) };
+            for (CFStringRef key : keys) {
+                CFNumberRef number = static_cast<CFNumberRef>(CFDictionaryGetValue(statistics, key));
+                qint64 value = 0;
+                if (number && CFNumberGetValue(number, kCFNumberSInt64Type, &value)) {
+                    time += value;
+                }
+            }
+            CFRelease(statistics);
+        }
+        IOObjectRelease(driver);
+    }
+    IOObjectRelease(drivers);
+    return time;
+#else
+    return 0;
+#endif
+}
+
+void
+TunerPrivate::adjust()
+{
+    Load current = sample();
+    double seconds = elapsed.restart() / 1000.0;
+    double total = qMax<double>(1, current.total - load.total);
+    double busy = (current.busy - load.busy) / total;
+    double iowait = (current.iowait - load.iowait) / total;
+    load = current;
+    if (completed == 0 || seconds <= 0) {
+        throughput = 0; // idle or jobs outlast the interval, nothing to learn from
+        return;
+    }
+    double rate = completed / seconds;
+    completed = 0;
+    const double tolerance = 0.05;
+    int step = direction;
+    if (busy > 0.95 || iowait > 0.20) {
+        step = -1; // saturated, more threads only add contention
+    } else if (throughput > 0) {
+        if (rate < throughput * (1.0 - tolerance)) {
+            step = -direction; // got worse, go back
+        } else if (rate < throughput * (1.0 + tolerance)) {
+            step = -1; // no gain, prefer fewer threads
+        }
+    }
+    direction = step;
+    throughput = (throughput > 0) ? (throughput + rate) / 2.0 : rate; // smooth out noisy batches
+    setThreads(threads + step);
+}
+
+void
+TunerPrivate::setThreads(int value)
+{
+    value = qBound(minimum, value, maximum);
+    if (threads != value) {
+        threads = value;
+        if (enabled) {
+            tuner->threadsChanged(threads);
+        }
+    }
+}
+
+#include "tuner.moc"
+
+Tuner::Tuner(QObject* parent)
+: QObject(parent)
+, p(new TunerPrivate())
+{
+    p->tuner = this;
+    p->init();
+}
+
+Tuner::~Tuner()
+{
+}
+
+bool
+Tuner::isEnabled() const
+{
+    return p->enabled;
+}
+
+void
+Tuner::setEnabled(bool enabled)
+{
+    if (p->enabled != enabled) {
+        p->enabled = enabled;
+        p->completed = 0;
+        p->throughput = 0;
+        p->direction = 1;
+        if (enabled) {
+            p->load = p->sample();
+            p->elapsed.start();
+            p->timer.start();
+        } else {
+            p->timer.stop();
+        }
+    }
+}
+
+int
+Tuner::minimum() const
+{
+    return p->minimum;
+}
+
+int
+Tuner::maximum() const
+{
+    return p->maximum;
+}
+
+void
+Tuner::setRange(int minimum, int maximum)
+{
+    p->minimum = qMax(1, minimum);
+    p->maximum = qMax(p->minimum, maximum);
+    p->setThreads(p->threads);
+}
+
+int
+Tuner::threads() const
+{
+    return p->threads;
+}
+
+void
+Tuner::setThreads(int threads)
+{
+    p->setThreads(threads);
+    p->throughput = 0; // new starting point
+}
+
+void
+Tuner::jobProcessed()
+{
+    p->completed++;
+}
@@ -0,0 +1,33 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include <QObject>
+#include <QScopedPointer>
+
+class TunerPrivate;
+class Tuner : public QObject
+{
+    Q_OBJECT
+    public:
+        Tuner(QObject* parent = nullptr);
+        virtual ~Tuner();
+        bool isEnabled() const;
+        void setEnabled(bool enabled);
+        int minimum() const;
+        int maximum() const;
+        void setRange(int minimum, int maximum);
+        int threads() const;
+        void setThreads(int threads);
+
+    public Q_SLOTS:
+        void jobProcessed();
+
+    Q_SIGNALS:
+        void threadsChanged(int threads);
+
+    private:
+        QScopedPointer<TunerPrivate> p;
+};
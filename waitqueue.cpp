@@ -0,0 +1,197 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#include "waitqueue.h"
+
+// binary max-heap ordered on key, ties broken by submit sequence,
+// positions are indexed by uuid for in-place updates and removal
+
+WaitQueue::WaitQueue()
+{
+}
+
+void
+WaitQueue::push(QSharedPointer<Job> job, qint64 key, quint64 sequence)
+{
+    QUuid uuid = job->uuid();
+    if (positions.contains(uuid)) {
+        update(uuid, key);
+        return;
+    }
+    Entry entry { job, uuid, key, sequence };
+    heap.append(entry);
+    positions.insert(uuid, heap.size() - 1);
+    siftUp(heap.size() - 1);
+}
+
+QSharedPointer<Job>
+WaitQueue::pop()
+{
+    if (heap.isEmpty()) {
+        return QSharedPointer<Job>();
+    }
+    QSharedPointer<Job> job = heap.first().job;
+    take(0);
+    return job;
+}
+
+QSharedPointer<Job>
+WaitQueue::top() const
+{
+    if (heap.isEmpty()) {
+        return QSharedPointer<Job>();
+    }
+    return heap.first().job;
+}
+
+bool
+WaitQueue::update(const QUuid& uuid, qint64 key)
+{
+    auto it = positions.constFind(uuid);
+    if (it == positions.constEnd()) {
+        return false;
+    }
+    int index = it.value();
+    qint64 previous = heap[index].key;
+    heap[index].key = key;
+    if (key > previous) {
+        siftUp(index);
+    } else if (key < previous) {
+        siftDown(index);
+    }
+    return true;
+}
+
+bool
+WaitQueue::remove(const QUuid& uuid)
+{
+    auto it = positions.constFind(uuid);
+    if (it == positions.constEnd()) {
+        return false;
+    }
+    take(it.value());
+    return true;
+}
+
+bool
+WaitQueue::contains(const QUuid& uuid) const
+{
+    return positions.contains(uuid);
+}
+
+qint64
+WaitQueue::key(const QUuid& uuid) const
+{
+    auto it = positions.constFind(uuid);
+    if (it == positions.constEnd()) {
+        return 0;
+    }
+    return heap[it.value()].key;
+}
+
+QHash<QUuid, qint64>
+WaitQueue::keys() const
+{
+    QHash<QUuid, qint64> keys;
+    keys.reserve(heap.size());
+    for (const Entry& entry : heap) {
+        keys.insert(entry.uuid, entry.key);
+    }
+    return keys;
+}
+
+int
+WaitQueue::size() const
+{
+    return heap.size();
+}
+
+bool
+WaitQueue::isEmpty() const
+{
+    return heap.isEmpty();
+}
+
+void
+WaitQueue::reserve(int size)
+{
+    heap.reserve(size);
+    positions.reserve(size);
+}
+
+void
+WaitQueue::clear()
+{
+    heap.clear();
+    positions.clear();
+}
+
+bool
+WaitQueue::before(const Entry& a, const Entry& b) const
+{
+    if (a.key != b.key) {
+        return a.key > b.key;
+    }
+    return a.sequence < b.sequence;
+}
+
+void
+WaitQueue::place(int index, const Entry& entry)
+{
+    heap[index] = entry;
+    positions[entry.uuid] = index;
+}
+
+void
+WaitQueue::siftUp(int index)
+{
+    Entry entry = heap[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!before(entry, heap[parent])) {
+            break;
+        }
+        place(index, heap[parent]);
+        index = parent;
+    }
+    place(index, entry);
+}
+
+void
+WaitQueue::siftDown(int index)
+{
+    Entry entry = heap[index];
+    int count = heap.size();
+    while (true) {
+        int child = 2 * index + 1;
+        if (child >= count) {
+            break;
+        }
+        if (child + 1 < count && before(heap[child + 1], heap[child])) {
+            child++;
+        }
+        if (!before(heap[child], entry)) {
+            break;
+        }
+        place(index, heap[child]);
+        index = child;
+    }
+    place(index, entry);
+}
+
+void
+WaitQueue::take(int index)
+{
+    positions.remove(heap[index].uuid);
+    int last = heap.size() - 1;
+    if (index != last) {
+        Entry entry = heap[last];
+        heap.removeLast();
+        place(index, entry);
+        siftDown(index);
+        siftUp(index);
+    } else {
+        heap.removeLast();
+    }
+}
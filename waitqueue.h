@@ -0,0 +1,45 @@
+// Copyright 2022-present Contributors to the jobman project.
+// SPDX-License-Identifier: BSD-3-Clause
+// https://github.com/mikaelsundell/jobman
+
+#pragma once
+
+#include "job.h"
+
+#include <QHash>
+#include <QSharedPointer>
+#include <QUuid>
+#include <QVector>
+
+class WaitQueue
+{
+    public:
+        WaitQueue();
+        void push(QSharedPointer<Job> job, qint64 key, quint64 sequence);
+        QSharedPointer<Job> pop();
+        QSharedPointer<Job> top() const;
+        bool update(const QUuid& uuid, qint64 key);
+        bool remove(const QUuid& uuid);
+        bool contains(const QUuid& uuid) const;
+        qint64 key(const QUuid& uuid) const;
+        QHash<QUuid, qint64> keys() const;
+        int size() const;
+        bool isEmpty() const;
+        void reserve(int size);
+        void clear();
+
+    private:
+        struct Entry {
+            QSharedPointer<Job> job;
+            QUuid uuid;
+            qint64 key;
+            quint64 sequence;
+        };
+        bool before(const Entry& a, const Entry& b) const;
+        void place(int index, const Entry& entry);
+        void siftUp(int index);
+        void siftDown(int index);
+        void take(int index);
+        QVector<Entry> heap;
+        QHash<QUuid, int> positions;
+};